@@ -6,11 +6,24 @@
 
 #define BLINK_TIME 500
 #define BUFFER_SIZE 128
+#define HISTORY_SIZE 512
+#define LOG_SIZE 256
 
-ConsoleInput console(&Serial, BUFFER_SIZE);
+ConsoleInput console(&Serial, BUFFER_SIZE, HISTORY_SIZE);
+char log_buffer[LOG_SIZE];
 
 void parser(const char *input);
 void dowork();
+void cmd_echo(int argc, char *argv[]);
+void cmd_uptime(int argc, char *argv[]);
+
+/* Commands handled by the dispatcher, sorted by name */
+static const char name_echo[] PROGMEM = "echo";
+static const char name_uptime[] PROGMEM = "uptime";
+static const ConsoleCommand commands[] PROGMEM = {
+    {name_echo, cmd_echo},
+    {name_uptime, cmd_uptime},
+};
 
 void setup()
 {
@@ -21,8 +34,11 @@ void setup()
 
     console.print(F("\x05"));     // Request Terminal ID
     console.print(F("\x1b\x63")); // Clear Terminal
-    /* entered lines are handled by our function */
+    /* known commands are dispatched, other lines are handled by our function */
+    console.setCommands(commands, sizeof(commands) / sizeof(commands[0]));
     console.setLineCallback(parser);
+    /* log lines are printed above the command line */
+    console.setLogBuffer(log_buffer, LOG_SIZE);
 
     console.println("ConsoleInput Setup Complete");
     console.println("---------------------------\n");
@@ -33,34 +49,34 @@ void loop()
     /* You can do other stuff here */
     dowork();
 
-    /* Check for a keypress and update the command line */
-    uint16_t key = console.readKey(); // required in loop()
+    /* Decode all pending input and update the command line once */
+    int16_t keys[4];
+    size_t count = console.poll(0, 0, keys, 4); // required in loop()
+    if (count > 4)
+        count = 4;
 
     /* Optionally Handle some special command line keys here, if required */
-    if (key == ConsoleInput::KEY_PAGE_UP || key == ConsoleInput::KEY_PAGE_DOWN ||
-        key == ConsoleInput::KEY_HOME || key == ConsoleInput::KEY_END)
+    for (size_t i = 0; i < count; i++)
     {
+        int16_t key = keys[i];
         switch (key)
         {
-            console.print(TERM_CLEAR_LINE);
-
         case ConsoleInput::KEY_PAGE_UP:
-            console.println("PAGE_UP pressed");
+            console.getLog().println("PAGE_UP pressed");
             break;
 
         case ConsoleInput::KEY_PAGE_DOWN:
-            console.println("PAGE_DOWN pressed");
+            console.getLog().println("PAGE_DOWN pressed");
             break;
 
         case ConsoleInput::KEY_HOME:
-            console.println(TERM_CLEAR_LINE "HOME pressed");
+            console.getLog().println("HOME pressed");
             break;
 
         case ConsoleInput::KEY_END:
-            console.println(TERM_CLEAR_LINE "END pressed");
+            console.getLog().println("END pressed");
             break;
         }
-        console.update();
     }
 
     /* The input is already handled via the parser() Callback function
@@ -70,8 +86,6 @@ void loop()
         console.println(console.getLine());
         console.clearLine();
     } */
-
-    delay(2);
 }
 
 void parser(const char *input)
@@ -85,6 +99,25 @@ void parser(const char *input)
     console.println();
 }
 
+void cmd_echo(int argc, char *argv[])
+{
+    console.println();
+    for (int i = 1; i < argc; i++)
+    {
+        console.print("[");
+        console.print(argv[i]);
+        console.print("] ");
+    }
+    console.println();
+}
+
+void cmd_uptime(int argc, char *argv[])
+{
+    console.println();
+    console.print(millis() / 1000);
+    console.println(" seconds");
+}
+
 bool led_state()
 {
     return (millis() / BLINK_TIME) % 2;
@@ -0,0 +1,158 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "Arduino.h"
+
+#include <time.h>
+
+// ======== Timing =========================
+
+static bool virtual_clock = false;
+static uint64_t virtual_us = 0;
+
+static uint64_t monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)(virtual_clock ? virtual_us : monotonic_us());
+}
+
+unsigned long millis(void)
+{
+    return (unsigned long)((virtual_clock ? virtual_us : monotonic_us()) / 1000);
+}
+
+void delay(unsigned long ms)
+{
+    if (virtual_clock)
+    {
+        virtual_us += (uint64_t)ms * 1000;
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+void yield(void)
+{
+}
+
+void hostUseVirtualClock(bool enable)
+{
+    if (enable && !virtual_clock)
+        virtual_us = monotonic_us();
+    virtual_clock = enable;
+}
+
+void hostAdvanceMicros(unsigned long us)
+{
+    virtual_us += us;
+}
+
+// ======== Print =========================
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+    {
+        if (write(*buffer++))
+            n++;
+        else
+            break;
+    }
+    return n;
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base == 10 && n < 0)
+    {
+        size_t len = print('-');
+        return len + print((unsigned long)-n, base);
+    }
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+
+    if (base < 2)
+        base = 10;
+
+    *str = '\0';
+    do
+    {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return write(str);
+}
+
+size_t Print::vprintf(const char *format, va_list args)
+{
+    char buf[128];
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(buf, sizeof(buf), format, copy);
+    va_end(copy);
+
+    if (len < 0)
+        return 0;
+    if ((size_t)len < sizeof(buf))
+        return write((const uint8_t *)buf, len);
+
+    char *big = (char *)malloc(len + 1);
+    if (big == NULL)
+        return 0;
+    vsnprintf(big, len + 1, format, args);
+    size_t n = write((const uint8_t *)big, len);
+    free(big);
+    return n;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t n = vprintf(format, args);
+    va_end(args);
+    return n;
+}
+
+size_t Print::printf_P(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t n = vprintf(format, args);
+    va_end(args);
+    return n;
+}
+
+// ======== Stream =========================
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length && available() > 0)
+    {
+        int c = read();
+        if (c < 0)
+            break;
+        *buffer++ = (char)c;
+        count++;
+    }
+    return count;
+}
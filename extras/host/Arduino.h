@@ -0,0 +1,115 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* Minimal Arduino core shim so the library can be built and measured on a
+   Linux host. Only what ConsoleInput and the host tools need is provided. */
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/types.h>
+
+// ======== Flash Memory =========================
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define strncmp_P strncmp
+#define strcmp_P strcmp
+#define strlen_P strlen
+#define strnlen_P strnlen
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(void *const *)(addr))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+
+// ======== Timing =========================
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);
+
+/* Host only: switch millis()/micros() to a virtual clock that only moves
+   when hostAdvanceMicros() is called, for deterministic runs */
+void hostUseVirtualClock(bool enable);
+void hostAdvanceMicros(unsigned long us);
+
+// ======== Print =========================
+
+#define DEC 10
+#define HEX 16
+
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t write(const char *str)
+  {
+    if (str == NULL)
+      return 0;
+    return write((const uint8_t *)str, strlen(str));
+  }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+  size_t print(const __FlashStringHelper *str) { return write((const char *)str); }
+  size_t print(const char str[]) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+
+  size_t println(void) { return write("\r\n"); }
+  template <typename T> size_t println(T value)
+  {
+    size_t n = print(value);
+    return n + println();
+  }
+  template <typename T> size_t println(T value, int base)
+  {
+    size_t n = print(value, base);
+    return n + println();
+  }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t printf_P(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+  size_t vprintf(const char *format, va_list args);
+};
+
+// ======== Stream =========================
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  virtual size_t readBytes(char *buffer, size_t length);
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+protected:
+  unsigned long _timeout = 1000;
+};
+
+#endif
@@ -0,0 +1,857 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* Keystroke throughput benchmark for ConsoleInput on a Linux host.
+
+   Every workload is a list of chunks. A chunk is released to the console at
+   once, like a burst arriving over the UART, and readKey() is then called
+   until the chunk is consumed, or poll() is called once for "/poll" workloads.
+   "/defer" workloads use readKey() with a 20 ms redraw interval.
+   "/bracket" workloads send the paste as a bracketed paste.
+   Keys counts input bytes for poll() and bracketed paste workloads. Reported per workload:
+     keys/s     keys decoded per second of readKey() time
+     out/key    redraw bytes written to the stream per decoded key
+     writes/key write() calls on the stream per decoded key, packets on USB-CDC or TCP
+     worst      worst-case latency of a single readKey() or poll() call
+   The end of every entered line must be on the terminal when its callback runs,
+   the exit status is non-zero when a line was not echoed, a log line was lost or
+   one of the behaviour checks in the other sections failed. */
+
+#include <Arduino.h>
+#include <ConsoleInput.h>
+#include <ConsoleServer.h>
+#include "ScriptedStream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct Workload
+{
+    const char *name;
+    std::vector<std::string> chunks;
+    bool use_poll;
+    size_t buffer_size;
+    uint16_t redraw_interval;
+    bool count_bytes; // a readKey() call may consume many keys
+};
+
+struct Result
+{
+    size_t keys;
+    size_t out_bytes;
+    size_t write_calls;
+    double total_ns;
+    double worst_ns;
+    size_t unechoed;
+};
+
+static size_t lines_seen = 0;
+static size_t lines_unechoed = 0;
+static ScriptedStream *echo_stream = NULL;
+static size_t echo_from = 0; // output written before the previous line was entered
+static bool print_stats = false;
+
+// Print to stdout, for ConsoleInput::printStats()
+class StdoutPrint : public Print
+{
+public:
+  virtual size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+  virtual size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+};
+
+// Print the result of a behaviour check, a failed check makes the exit status non-zero
+static bool checks_passed = true;
+static void report_check(const char *name, bool ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    checks_passed = checks_passed && ok;
+}
+
+static void count_line(const char *line)
+{
+    lines_seen++;
+    if (echo_stream == NULL)
+        return;
+
+    // lines edited with cursor keys are redrawn in pieces, their end is written last
+    size_t len = strlen(line);
+    const char *tail = len > 16 ? line + len - 16 : line;
+    if (echo_stream->output.find(tail, echo_from) == std::string::npos)
+        lines_unechoed++;
+    echo_from = echo_stream->output.size();
+}
+
+// ======== Workloads =========================
+
+static void add_keystrokes(Workload &w, const std::string &text)
+{
+    for (size_t i = 0; i < text.size(); i++)
+        w.chunks.push_back(std::string(1, text[i]));
+}
+
+static Workload typing_workload()
+{
+    Workload w = {"typing", {}, false, 256, 0, false};
+    for (int i = 0; i < 20; i++)
+        add_keystrokes(w, "config wifi ssid my-home-network channel 11\r");
+    return w;
+}
+
+static Workload escape_workload()
+{
+    static const char *keys[] = {"\e[D", "\e[D", "\e[C", "\e[1~", "\e[4~", "\e[3~", "\e[2~", "\e[5~",
+                                 "\e[6~", "\eOP", "\eOS", "\e[15~", "\e[24~", "\e[A", "\e[B"};
+    Workload w = {"escape", {}, false, 256, 0, false};
+    for (int i = 0; i < 20; i++)
+    {
+        add_keystrokes(w, "status all");
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++)
+            w.chunks.push_back(keys[k]);
+        w.chunks.push_back("\r");
+    }
+    return w;
+}
+
+static Workload paste_workload()
+{
+    Workload w = {"paste", {}, false, 256, 0, false};
+    std::string line;
+    while (line.size() < 200)
+        line += "set gpio 12 mode output pull none; ";
+    line.resize(200);
+    for (int i = 0; i < 20; i++)
+        w.chunks.push_back(line + "\r");
+    return w;
+}
+
+static Workload bracket_workload()
+{
+    Workload w = paste_workload();
+    w.name = "paste/bracket";
+    w.count_bytes = true;
+    for (size_t i = 0; i < w.chunks.size(); i++)
+        w.chunks[i] = "\e[200~" + w.chunks[i] + "\e[201~";
+    return w;
+}
+
+static Workload history_workload()
+{
+    Workload w = {"history", {}, false, 256, 0, false};
+    for (int i = 0; i < 20; i++)
+    {
+        add_keystrokes(w, "ping 192.168.1." + std::to_string(i) + "\r");
+        w.chunks.push_back("\e[A");
+        w.chunks.push_back("\e[A");
+        w.chunks.push_back("\e[B");
+        w.chunks.push_back("\e[A");
+        w.chunks.push_back("\r");
+    }
+    return w;
+}
+
+static Workload long_line_workload()
+{
+    Workload w = {"long-line", {}, false, 4096, 0, false};
+    for (int i = 0; i < 5; i++)
+    {
+        w.chunks.push_back(std::string(3000, 'x'));
+        w.chunks.push_back("\e[1~");
+        add_keystrokes(w, "echo ");
+        w.chunks.push_back("\e[4~");
+        add_keystrokes(w, "\x7f\x7f\x7f\x7f\x7f");
+        w.chunks.push_back("\r");
+    }
+    return w;
+}
+
+// ======== History Search =========================
+
+// Time a function over all prefixes of the patterns, in ns per keystroke
+template <typename F> static double time_keystrokes(const std::vector<std::string> &patterns, int rounds, F search)
+{
+    size_t keystrokes = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t p = 0; p < patterns.size(); p++)
+        {
+            for (size_t len = 1; len <= patterns[p].size(); len++)
+                search(patterns[p], len);
+            keystrokes += patterns[p].size();
+        }
+    }
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / keystrokes;
+}
+
+// Down after a reverse search match was accepted, with prefix recall on, steps to the next
+// newer entry and not back to the prefix of an earlier recall, which is longer than the match
+static bool check_search_recall()
+{
+    ScriptedStream stream;
+    ConsoleInput console(&stream, 64, 256);
+    console.setPrefixRecall(true);
+
+    stream.script("abc\rabcdef ghijkl\rabcdef ghij\e[A\e[B");
+    stream.script(std::string(11, '\x7f') + "c\x12\x12\e[B");
+    stream.release();
+    while (stream.available() > 0)
+        console.readKey();
+
+    return strcmp(console.getLine(), "abcdef ghijkl") == 0 && console.getCaret() == 13;
+}
+
+// Incremental reverse search and prefix recall against a linear scan of every entry
+static void bench_search(int rounds)
+{
+    const uint16_t entries = 512;
+    ConsoleHistory history(0xffff, entries);
+
+    static const char *verbs[] = {"diag sensor ", "mqtt publish home/", "wifi scan ", "gpio read ", "ping 10.0.0."};
+    for (uint16_t i = 0; i < entries; i++)
+    {
+        std::string line = std::string(verbs[i % 5]) + std::to_string(i * 7919 % 1000) + " --verbose --count 3";
+        history.push(line.c_str(), line.size());
+    }
+
+    std::vector<std::string> patterns;
+    patterns.push_back("sensor 12");
+    patterns.push_back("home/50");
+    patterns.push_back("scan 7");
+    patterns.push_back("10.0.0.9");
+
+    size_t found = 0;
+    double incremental = time_keystrokes(patterns, rounds, [&](const std::string &p, size_t len) {
+        found += history.search(p.c_str(), len, len > 1);
+    });
+
+    char buf[256];
+    size_t found_linear = 0;
+    double linear = time_keystrokes(patterns, rounds, [&](const std::string &p, size_t len) {
+        std::string pattern = p.substr(0, len);
+        for (uint16_t e = 0; e < history.count(); e++)
+        {
+            buf[history.copy(e, buf, sizeof(buf) - 1)] = 0;
+            if (strstr(buf, pattern.c_str()) != NULL)
+                found_linear++;
+        }
+    });
+
+    std::vector<std::string> prefixes;
+    prefixes.push_back("diag sensor 9");
+    prefixes.push_back("ping 10.0.0.3");
+    prefixes.push_back("gpio read 1");
+
+    size_t hits = 0;
+    double prefix = time_keystrokes(prefixes, rounds, [&](const std::string &p, size_t len) {
+        for (int32_t e = history.findPrefix(0, true, p.c_str(), len); e >= 0;
+             e = history.findPrefix(e + 1, true, p.c_str(), len))
+            hits++;
+    });
+
+    size_t hits_linear = 0;
+    double prefix_linear = time_keystrokes(prefixes, rounds, [&](const std::string &p, size_t len) {
+        for (uint16_t e = 0; e < history.count(); e++)
+        {
+            buf[history.copy(e, buf, sizeof(buf) - 1)] = 0;
+            if (strncmp(buf, p.c_str(), len) == 0)
+                hits_linear++;
+        }
+    });
+
+    printf("\nHistory search, %u entries\n\n", history.count());
+    printf("%-22s %12s %10s\n", "search", "ns/key", "matches");
+    printf("%-22s %12.0f %10zu\n", "reverse incremental", incremental, found);
+    printf("%-22s %12.0f %10zu\n", "reverse linear scan", linear, found_linear);
+    printf("%-22s %12.0f %10zu\n", "prefix index", prefix, hits);
+    printf("%-22s %12.0f %10zu\n", "prefix linear scan", prefix_linear, hits_linear);
+#if CONSOLE_HISTORY
+    printf("\n");
+    report_check("search, accept, Down with prefix recall", check_search_recall());
+#endif
+}
+
+// ======== Completion =========================
+
+// TAB completion latency with a vocabulary of several hundred commands
+static void bench_completion(int rounds)
+{
+    static const char *groups[] = {"config", "diag", "gpio", "mqtt", "sensor", "wifi"};
+    static const char *actions[] = {"get", "list", "reset", "set", "show"};
+
+    std::vector<std::string> vocabulary;
+    for (size_t g = 0; g < 6; g++)
+        for (int n = 0; n < 20; n++)
+            for (size_t a = 0; a < 5; a++)
+                vocabulary.push_back(std::string(groups[g]) + std::to_string(n) + " " + actions[a]);
+    std::sort(vocabulary.begin(), vocabulary.end());
+
+    std::vector<const char *> words;
+    for (size_t i = 0; i < vocabulary.size(); i++)
+        words.push_back(vocabulary[i].c_str());
+
+    ScriptedStream stream;
+    ConsoleInput console(&stream, 256);
+    console.setCompletion(&words[0], words.size());
+
+    static const char *inputs[] = {"mqtt1", "sensor17 s", "wifi3 r", "diag", "gpio12 li"};
+    size_t tabs = 0;
+    double total_ns = 0;
+    double worst_ns = 0;
+
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+        {
+            stream.script(inputs[i]);
+            stream.release();
+            while (stream.available() > 0)
+                console.readKey();
+
+            stream.script("\t");
+            stream.release();
+            bench_clock::time_point start = bench_clock::now();
+            console.readKey();
+            double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+            total_ns += ns;
+            if (ns > worst_ns)
+                worst_ns = ns;
+            tabs++;
+
+            console.clearLine();
+            stream.reset();
+        }
+    }
+
+    printf("\nCompletion, %zu words\n\n", words.size());
+    printf("%-22s %12s %12s\n", "", "ns/tab", "worst(us)");
+    printf("%-22s %12.0f %12.2f\n", "sorted table", total_ns / tabs, worst_ns / 1000.0);
+}
+
+// ======== Dispatch =========================
+
+static size_t handled = 0;
+static size_t chained = 0;
+static std::vector<std::string> command_names;
+
+static void count_command(int argc, char *argv[])
+{
+    handled += argc;
+}
+
+// What sketches do today: split a copy of the line and compare against every command
+static void chain_parser(const char *line)
+{
+    char buf[256];
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+
+    char *argv[CONSOLE_MAX_ARGS];
+    int argc = ConsoleInput::tokenize(buf, argv, CONSOLE_MAX_ARGS);
+    for (size_t c = 0; argc > 0 && c < command_names.size(); c++)
+        if (strcmp(argv[0], command_names[c].c_str()) == 0)
+        {
+            chained += argc;
+            break;
+        }
+}
+
+static double time_lines(ConsoleInput &console, ScriptedStream &stream, const std::vector<std::string> &lines,
+                         int rounds)
+{
+    bench_clock::time_point start = bench_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < lines.size(); i++)
+            stream.script(lines[i]);
+        stream.release();
+        console.poll();
+        stream.reset();
+    }
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / (rounds * lines.size());
+}
+
+// Decode and dispatch scripted lines through the command table and through a strcmp chain
+static void bench_dispatch(int rounds)
+{
+    for (int i = 0; i < 300; i++)
+        command_names.push_back("cmd" + std::to_string(i * 7919 % 1000));
+    std::sort(command_names.begin(), command_names.end());
+
+    std::vector<ConsoleCommand> table;
+    for (size_t i = 0; i < command_names.size(); i++)
+    {
+        ConsoleCommand cmd = {command_names[i].c_str(), count_command};
+        table.push_back(cmd);
+    }
+
+    // commands near the end of the table are the worst case for the chain
+    std::vector<std::string> lines;
+    for (size_t i = command_names.size() / 2; i < command_names.size(); i += 7)
+        lines.push_back(command_names[i] + " \"quoted arg\" plain\\ escaped 42\r");
+
+    ScriptedStream stream;
+    ConsoleInput table_console(&stream, 256);
+    table_console.setCommands(&table[0], table.size());
+    double table_ns = time_lines(table_console, stream, lines, rounds);
+
+    ConsoleInput chain_console(&stream, 256);
+    chain_console.setLineCallback(chain_parser);
+    double chain_ns = time_lines(chain_console, stream, lines, rounds);
+
+    printf("\nDispatch, %zu commands\n\n", table.size());
+    printf("%-22s %12s %10s\n", "", "ns/line", "args");
+    printf("%-22s %12.0f %10zu\n", "sorted table", table_ns, handled);
+    printf("%-22s %12.0f %10zu\n", "strcmp chain", chain_ns, chained);
+}
+
+// ======== Slow Link =========================
+
+// Stream without flow control, availableForWrite() is the default of Print, or with
+// write() accepting at most a few bytes per call, like a socket with a full send buffer
+class LimitedStream : public ScriptedStream
+{
+public:
+  bool flow_control = true;
+  size_t per_write = 0; // 0 for no limit
+
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+      return ScriptedStream::write(buffer, per_write > 0 && size > per_write ? per_write : size);
+  }
+  virtual int availableForWrite()
+  {
+      return flow_control ? ScriptedStream::availableForWrite() : Print::availableForWrite();
+  }
+
+  using Print::write;
+};
+
+// Type or paste a line and check that it was written to the stream
+static bool check_output(LimitedStream &stream, bool non_blocking, bool paste)
+{
+    static uint8_t queue[128];
+    const char *text = "config wifi ssid my-home-network";
+    ConsoleInput console(&stream, 128);
+    if (non_blocking)
+        console.setNonBlocking(queue, sizeof(queue));
+
+    stream.script(text);
+    stream.release();
+    if (paste)
+        console.poll();
+    while (stream.available() > 0)
+        console.readKey();
+    return stream.output.find(text) != std::string::npos;
+}
+
+// Typing and history recall over a link that sends 2 bytes per key into a 16 byte
+// transmit buffer, with blocking writes and with a non-blocking output queue
+// Blocked counts the bytes written while the transmit buffer was full
+static void bench_slow_link(int rounds)
+{
+    Workload w = history_workload();
+    static uint8_t queue[128];
+
+    printf("\nSlow link, 2 bytes per key, 16 byte transmit buffer\n\n");
+    printf("%-22s %12s %10s %10s\n", "", "ns/key", "blocked", "queue max");
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        ScriptedStream stream;
+        ConsoleInput console(&stream, 256, 1024, 32);
+        if (mode == 1)
+            console.setNonBlocking(queue, sizeof(queue));
+        stream.limitWrite(16);
+
+        size_t keys = 0;
+        size_t blocked = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (int r = 0; r < rounds; r++)
+        {
+            for (size_t c = 0; c < w.chunks.size(); c++)
+            {
+                stream.script(w.chunks[c]);
+                stream.release();
+                while (stream.available() > 0)
+                    console.readKey();
+                stream.drainWrite(2);
+                keys++;
+            }
+            blocked += stream.overrun;
+            stream.reset();
+        }
+        double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+
+        printf("%-22s %12.0f %10zu %10zu\n", mode == 0 ? "blocking" : "non-blocking queue", ns / keys, blocked,
+               mode == 0 ? (size_t)0 : console.getOutputHighWater());
+    }
+
+    printf("\n");
+    LimitedStream no_flow;
+    no_flow.flow_control = false;
+    report_check("non-blocking without availableForWrite()", check_output(no_flow, true, false));
+    LimitedStream short_writes;
+    short_writes.per_write = 5;
+    report_check("blocking with short writes", check_output(short_writes, false, true));
+}
+
+// ======== Log Output =========================
+
+// 10 log lines per loop iteration while a line is being edited, printed with
+// TERM_CLEAR_LINE and update() per line or through the buffered log, the last
+// time over a slow link with a non-blocking queue that is too small for them
+// Returns the number of log lines that did not reach the stream
+static size_t bench_log(int rounds)
+{
+    static char log_buf[512];
+    static uint8_t queue[128];
+    size_t lost_total = 0;
+
+    printf("\nLog output, 10 lines per loop iteration\n\n");
+    printf("%-22s %12s %10s %11s %8s\n", "", "ns/line", "out/line", "writes/line", "lost");
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        ScriptedStream stream;
+        ConsoleInput console(&stream, 256);
+        if (mode > 0)
+            console.setLogBuffer(log_buf, sizeof(log_buf));
+        if (mode == 2)
+        {
+            console.setNonBlocking(queue, sizeof(queue));
+            stream.limitWrite(16);
+        }
+        stream.script("config wifi ssid my-home");
+        stream.release();
+        while (stream.available() > 0)
+            console.readKey();
+        stream.clearOutput();
+
+        size_t lines = 0;
+        size_t delivered = 0;
+        size_t out_bytes = 0;
+        size_t write_calls = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (int r = 0; r < rounds * 10; r++)
+        {
+            for (int i = 0; i < 10; i++, lines++)
+            {
+                if (mode == 0)
+                {
+                    console.print(F(TERM_CLEAR_LINE "sensor reading "));
+                    console.println(i);
+                    console.update();
+                }
+                else
+                {
+                    console.getLog().print(F("sensor reading "));
+                    console.getLog().println(i);
+                }
+            }
+            console.readKey();
+            stream.drainWrite(64);
+            for (size_t pos = stream.output.find("sensor reading "); pos != std::string::npos;
+                 pos = stream.output.find("sensor reading ", pos + 1))
+                delivered++;
+            out_bytes += stream.output.size();
+            write_calls += stream.write_calls;
+            stream.clearOutput();
+        }
+        double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+
+        static const char *names[] = {"println + update", "log buffer", "log buffer, slow link"};
+        size_t lost = lines - delivered;
+        printf("%-22s %12.0f %10.1f %11.2f %8zu\n", names[mode], ns / lines, (double)out_bytes / lines,
+               (double)write_calls / lines, lost);
+        lost_total += lost;
+    }
+    return lost_total;
+}
+
+// ======== Passthrough =========================
+
+static size_t pass_bytes = 0;
+
+static void count_pass(const uint8_t *data, size_t len, bool end)
+{
+    pass_bytes += len;
+}
+
+// COBS encoding of a block, ending with the zero delimiter
+static std::string cobs_encode(const std::string &in)
+{
+    std::string out(1, 1);
+    size_t code_pos = 0;
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        if (in[i] == 0)
+        {
+            out[code_pos] = out.size() - code_pos;
+            code_pos = out.size();
+            out.push_back(1);
+            continue;
+        }
+
+        out.push_back(in[i]);
+        if (out.size() - code_pos == 0xff)
+        { // a full group is not followed by a zero
+            out[code_pos] = (char)0xff;
+            code_pos = out.size();
+            out.push_back(1);
+        }
+    }
+    out[code_pos] = out.size() - code_pos;
+    out.push_back(0);
+    return out;
+}
+
+// A preamble that starts again inside a partial match is still found, the bytes before it
+// are typed on the line and the length framed block after it is passed through
+static bool check_preamble(const char *preamble, const char *input, const char *typed)
+{
+    ScriptedStream stream;
+    ConsoleInput console(&stream, 64);
+    console.setPassthrough(count_pass, ConsoleInput::PASS_LENGTH, preamble);
+    pass_bytes = 0;
+
+    stream.script(input);
+    stream.script(std::string("\0\4data", 6));
+    stream.release();
+    console.poll();
+    return pass_bytes == 4 && strcmp(console.getLine(), typed) == 0;
+}
+
+// Binary blocks passed to a callback, against decoding the same bytes as keys
+static void bench_passthrough(int rounds)
+{
+    static uint8_t block_buf[1024];
+    std::string block;
+    for (int i = 0; i < 4096; i++)
+        block.push_back((char)(i * 131 % 251));
+
+    std::string framed[2];
+    framed[0] = "\x02BIN";
+    framed[0].push_back((char)(block.size() >> 8));
+    framed[0].push_back((char)(block.size() & 0xff));
+    framed[0] += block;
+    framed[1] = "\x02BIN" + cobs_encode(block);
+
+    printf("\nPassthrough of a 4096 byte block in 256 byte bursts\n\n");
+    printf("%-22s %12s %10s\n", "", "MB/s", "delivered");
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        ScriptedStream stream;
+        ConsoleInput console(&stream, 256);
+        console.setPassthrough(count_pass, mode == 2 ? ConsoleInput::PASS_COBS : ConsoleInput::PASS_LENGTH,
+                               mode > 0 ? "\x02BIN" : NULL, block_buf, sizeof(block_buf));
+        pass_bytes = 0;
+
+        size_t bytes = 0;
+        double ns = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            stream.script(mode == 2 ? framed[1] : framed[0]);
+            bench_clock::time_point start = bench_clock::now();
+            while (!stream.exhausted())
+            {
+                stream.release(256);
+                console.poll();
+            }
+            ns += std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+            bytes += mode == 2 ? framed[1].size() : framed[0].size();
+            stream.reset();
+        }
+
+        static const char *names[] = {"decoded as keys", "length framed", "COBS"};
+        printf("%-22s %12.1f %10zu\n", names[mode], bytes * 1e3 / ns, pass_bytes / rounds);
+    }
+
+#if CONSOLE_PASSTHROUGH
+    printf("\n");
+    report_check("preamble ZZQ after ZZZQ", check_preamble("ZZQ", "ZZZQ", "Z"));
+    report_check("preamble ABAC after xABABAC", check_preamble("ABAC", "xABABAC", "xAB"));
+#endif
+}
+
+// ======== Console Server =========================
+
+// Poll cost of a ConsoleServer with a shared history as the number of sessions grows
+// idle: no input, one key: a key on one session, all keys: a key on every session
+static void bench_server(int rounds)
+{
+    static const size_t counts[] = {1, 8, 32, 64};
+    const size_t line_size = 128, history_size = 2048;
+    const uint16_t entries = 64;
+    size_t session = ConsoleServer::sessionSize(line_size, 0, entries, true);
+
+    printf("\nConsole server, %zu byte lines, shared history of %zu bytes, %zu bytes per session\n\n", line_size,
+           history_size, session);
+    printf("%-10s %10s %12s %12s %14s %10s\n", "sessions", "arena", "idle(ns)", "one key(ns)", "all keys(ns)",
+           "history");
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        size_t n = counts[c];
+        std::vector<uint8_t> arena(ConsoleServer::sharedSize(history_size, entries) + n * session + 8);
+        ConsoleServer server(arena.data(), arena.size(), line_size, history_size, entries, true);
+        std::vector<ScriptedStream> streams(n);
+        for (size_t i = 0; i < n; i++)
+            server.open(&streams[i]);
+        server.poll(); // draw the prompts
+
+        bench_clock::time_point start = bench_clock::now();
+        for (int r = 0; r < rounds * 10; r++)
+            server.poll();
+        double idle = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / (rounds * 10);
+
+        double one = 0, all = 0;
+        size_t polls = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            std::string line = "set sensor " + std::to_string(r) + "\r";
+            polls += line.size();
+            for (size_t k = 0; k < line.size(); k++)
+            {
+                ScriptedStream &stream = streams[(r * 31 + k) % n];
+                stream.script(&line[k], 1);
+                stream.release();
+                start = bench_clock::now();
+                server.poll();
+                one += std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+            }
+
+            for (size_t k = 0; k < line.size(); k++)
+            {
+                for (size_t i = 0; i < n; i++)
+                {
+                    streams[i].script(&line[k], 1);
+                    streams[i].release();
+                }
+                start = bench_clock::now();
+                server.poll();
+                all += std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+            }
+            for (size_t i = 0; i < n; i++)
+                streams[i].reset();
+        }
+
+        printf("%-10zu %10zu %12.0f %12.0f %14.0f %10u\n", server.count(), arena.size(), idle, one / polls,
+               all / polls, server.getHistory() != NULL ? server.getHistory()->count() : 0);
+    }
+}
+
+// ======== Runner =========================
+
+static Result run(const Workload &w, int rounds)
+{
+    ScriptedStream stream;
+    ConsoleInput console(&stream, w.buffer_size, 1024, 32);
+    console.setLineCallback(count_line);
+    console.setRedrawInterval(w.redraw_interval);
+
+    Result res = {0, 0, 0, 0, 0, 0};
+    echo_stream = &stream;
+    echo_from = 0;
+    lines_unechoed = 0;
+
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t c = 0; c < w.chunks.size(); c++)
+        {
+            stream.script(w.chunks[c]);
+            stream.release();
+
+            while (stream.available() > 0)
+            {
+                int before = stream.available();
+                bench_clock::time_point start = bench_clock::now();
+                int16_t key = w.use_poll ? 0 : console.readKey();
+                if (w.use_poll)
+                    console.poll();
+                double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+
+                res.total_ns += ns;
+                if (ns > res.worst_ns)
+                    res.worst_ns = ns;
+                if (w.use_poll || w.count_bytes)
+                    res.keys += before - stream.available();
+                else if (key != 0)
+                    res.keys++;
+            }
+        }
+        res.out_bytes += stream.output.size();
+        res.write_calls += stream.write_calls;
+        stream.reset();
+        echo_from = 0;
+    }
+    echo_stream = NULL;
+    res.unechoed = lines_unechoed;
+
+    if (print_stats)
+    {
+        StdoutPrint out;
+        printf("\nStatistics of the %s workload\n\n", w.name);
+        console.printStats(out);
+    }
+    return res;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    if (rounds <= 0)
+        rounds = 1;
+
+    std::vector<Workload> workloads;
+    workloads.push_back(typing_workload());
+    workloads.push_back(escape_workload());
+    workloads.push_back(paste_workload());
+    workloads.push_back(paste_workload());
+    workloads.back().name = "paste/poll";
+    workloads.back().use_poll = true;
+    workloads.push_back(paste_workload());
+    workloads.back().name = "paste/defer";
+    workloads.back().redraw_interval = 20;
+    workloads.push_back(bracket_workload());
+    workloads.push_back(history_workload());
+    workloads.push_back(long_line_workload());
+
+    printf("ConsoleInput benchmark, %d rounds per workload\n\n", rounds);
+    printf("%-14s %10s %12s %10s %11s %12s\n", "workload", "keys", "keys/s", "out/key", "writes/key", "worst(us)");
+
+    size_t unechoed = 0;
+    for (size_t i = 0; i < workloads.size(); i++)
+    {
+        Result res = run(workloads[i], rounds);
+        double keys_per_s = res.total_ns > 0 ? res.keys * 1e9 / res.total_ns : 0;
+        double out_per_key = res.keys ? (double)res.out_bytes / res.keys : 0;
+        double writes_per_key = res.keys ? (double)res.write_calls / res.keys : 0;
+
+        printf("%-14s %10zu %12.0f %10.1f %11.2f %12.2f\n", workloads[i].name, res.keys, keys_per_s, out_per_key,
+               writes_per_key, res.worst_ns / 1000.0);
+        if (res.unechoed > 0)
+            printf("%-14s %zu entered lines were not echoed\n", "", res.unechoed);
+        unechoed += res.unechoed;
+    }
+
+#if CONSOLE_STATS
+    print_stats = true;
+    run(history_workload(), 1);
+    print_stats = false;
+#endif
+
+    bench_search(rounds / 10 + 1);
+    bench_completion(rounds);
+    bench_dispatch(rounds);
+    bench_slow_link(rounds);
+    size_t log_lost = bench_log(rounds);
+    bench_passthrough(rounds);
+    bench_server(rounds);
+
+    return unechoed > 0 || log_lost > 0 || !checks_passed ? 1 : 0;
+}
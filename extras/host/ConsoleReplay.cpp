@@ -0,0 +1,334 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* Deterministic replay of sessions recorded with ConsoleRecorder.
+
+   The input records of a trace are released to a console on the virtual clock
+   at their recorded time, and readKey() is called until each one is consumed.
+   Pending escape sequences are flushed at their deadline, like a loop calling
+   readKey() continuously would. The output of the console must match the
+   recorded output byte for byte. Reported per trace:
+     events     input records, one burst of bytes each
+     keys/s     input bytes decoded per second of readKey() time
+     p50/p99/max  processing time of one event in us
+
+   The console is created like ConsoleInput console(&Serial, 128, 512), use -b
+   and -h for traces recorded with other sizes. Output printed by the application
+   is part of the trace but not of the replay, use -n to skip the output check
+   for such sessions. The exit status is non-zero when an output differs or
+   keys/s is below the -m limit.
+
+     ConsoleReplay -w file           record the built-in sample session
+     ConsoleReplay [options] file... replay traces */
+
+#include <Arduino.h>
+#include <ConsoleInput.h>
+#include <ConsoleRecorder.h>
+#include "ScriptedStream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock replay_clock;
+
+struct TraceRecord
+{
+    bool output;
+    uint32_t time; // us since the first record
+    std::string data;
+};
+
+static size_t buffer_size = 128;
+static size_t history_size = 512;
+
+// Print appending to a string, the trace of the sample session
+class StringPrint : public Print
+{
+public:
+  std::string data;
+  virtual size_t write(uint8_t c)
+  {
+      data.push_back((char)c);
+      return 1;
+  }
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+      data.append((const char *)buffer, size);
+      return size;
+  }
+};
+
+// ======== Trace file =========================
+
+static bool read_file(const char *path, std::string &out)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        out.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+static bool parse_trace(const std::string &raw, std::vector<TraceRecord> &records)
+{
+    if (raw.size() < 4 || raw.compare(0, 4, "CIT1") != 0)
+        return false;
+
+    size_t pos = 4;
+    uint32_t time = 0;
+    while (pos < raw.size())
+    {
+        uint8_t tag = raw[pos++];
+        uint32_t delta = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            if (pos >= raw.size() || shift > 28)
+                return false;
+            uint8_t b = raw[pos++];
+            delta |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+
+        size_t len = (tag & 0x7f) + 1;
+        if (pos + len > raw.size())
+            return false;
+
+        time += delta;
+        TraceRecord rec = {(tag & 0x80) != 0, time, raw.substr(pos, len)};
+        records.push_back(rec);
+        pos += len;
+    }
+    return true;
+}
+
+// ======== Sample session =========================
+
+// Typing with 80 ms between keys, cursor keys, a lone ESC, a paste and a history recall,
+// read by a loop that calls readKey() every millisecond
+static bool write_sample(const char *path)
+{
+    struct Step
+    {
+        uint32_t gap_ms;
+        const char *bytes;
+    };
+    static const Step steps[] = {
+        {500, "h"},  {80, "e"},     {80, "l"},    {80, "p"},    {120, "\r"},   {300, "w"},
+        {80, "i"},   {80, "f"},     {80, "i"},    {200, "\e[D"}, {80, "\e[D"}, {80, "x"},
+        {150, "\e[3~"}, {150, "\e[F"}, {400, "\e"}, {600, "\r"}, {300, "config wifi ssid my-home-network channel 11"},
+        {200, "\r"}, {400, "\e[A"}, {200, "\e[A"}, {200, "\e[B"}, {150, "\x7f\x7f"}, {100, "12\r"}, {300, "\eOP"},
+    };
+
+    ScriptedStream stream;
+    StringPrint trace;
+    ConsoleRecorder recorder(&stream, &trace);
+    ConsoleInput console(&recorder, buffer_size, history_size);
+
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++)
+    {
+        for (uint32_t ms = 0; ms < steps[i].gap_ms; ms++)
+        {
+            hostAdvanceMicros(1000);
+            console.readKey();
+        }
+        stream.script(steps[i].bytes);
+        stream.release();
+        while (!stream.exhausted())
+            console.readKey();
+    }
+    for (int ms = 0; ms < 500; ms++)
+    {
+        hostAdvanceMicros(1000);
+        console.readKey();
+    }
+    recorder.flushTrace();
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(trace.data.data(), 1, trace.data.size(), f) == trace.data.size();
+    return fclose(f) == 0 && ok;
+}
+
+// ======== Replay =========================
+
+struct Result
+{
+    size_t events;
+    size_t keys;
+    double total_ns;
+    std::vector<uint32_t> latency_ns;
+    long mismatch; // offset of the first differing output byte, -1 when equal
+};
+
+// Advance the virtual clock to at, flushing pending escape sequences at their deadline
+static void advance_to(ConsoleInput &console, uint32_t &now, uint32_t at)
+{
+    for (;;)
+    {
+        uint32_t deadline = console.nextDeadline();
+        if (deadline == ConsoleInput::NO_DEADLINE || deadline > at - now)
+            break;
+        hostAdvanceMicros(deadline);
+        now += deadline;
+        console.readKey();
+    }
+    hostAdvanceMicros(at - now);
+    now = at;
+}
+
+static void replay(const std::vector<TraceRecord> &records, Result &res)
+{
+    ScriptedStream stream;
+    ConsoleInput console(&stream, buffer_size, history_size);
+    std::string expected;
+    uint32_t now = 0;
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const TraceRecord &rec = records[i];
+        if (rec.output)
+        {
+            expected += rec.data;
+            continue;
+        }
+
+        advance_to(console, now, rec.time);
+        stream.script(rec.data);
+        stream.release();
+
+        replay_clock::time_point start = replay_clock::now();
+        while (!stream.exhausted())
+            console.readKey();
+        double ns = std::chrono::duration<double, std::nano>(replay_clock::now() - start).count();
+
+        res.events++;
+        res.keys += rec.data.size();
+        res.total_ns += ns;
+        res.latency_ns.push_back((uint32_t)ns);
+    }
+
+    // flush a sequence still pending at the end of the session
+    if (console.nextDeadline() != ConsoleInput::NO_DEADLINE)
+        advance_to(console, now, now + console.nextDeadline());
+
+    const std::string &out = stream.output;
+    size_t n = std::min(out.size(), expected.size());
+    size_t pos = std::mismatch(out.begin(), out.begin() + n, expected.begin()).first - out.begin();
+    if (res.mismatch < 0 && (pos < n || out.size() != expected.size()))
+        res.mismatch = (long)pos;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: ConsoleReplay -w trace\n"
+                    "       ConsoleReplay [-r rounds] [-b buffer] [-h history] [-m min_keys_per_s] [-n] trace...\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = 20;
+    double min_rate = 0;
+    bool check_output = true;
+    std::vector<const char *> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0)
+            check_output = false;
+        else if (argv[i][0] == '-' && argv[i][1] != 0 && argv[i][2] == 0 && i + 1 < argc)
+        {
+            const char *value = argv[++i];
+            switch (argv[i - 1][1])
+            {
+            case 'w':
+                hostUseVirtualClock(true);
+                if (!write_sample(value))
+                {
+                    perror(value);
+                    return 1;
+                }
+                return 0;
+            case 'r':
+                rounds = atoi(value) > 0 ? atoi(value) : 1;
+                break;
+            case 'b':
+                buffer_size = (size_t)atol(value);
+                break;
+            case 'h':
+                history_size = (size_t)atol(value);
+                break;
+            case 'm':
+                min_rate = atof(value);
+                break;
+            default:
+                usage();
+            }
+        }
+        else if (argv[i][0] == '-')
+            usage();
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty())
+        usage();
+
+    hostUseVirtualClock(true);
+
+    printf("ConsoleInput replay, %d rounds per trace, latency per event in us\n\n", rounds);
+    printf("%-24s %8s %8s %12s %8s %8s %8s  %s\n", "trace", "events", "keys", "keys/s", "p50", "p99", "max",
+           "output");
+
+    bool ok = true;
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        std::string raw;
+        std::vector<TraceRecord> records;
+        if (!read_file(files[f], raw) || !parse_trace(raw, records))
+        {
+            printf("%-24s invalid trace\n", files[f]);
+            ok = false;
+            continue;
+        }
+
+        Result res = {0, 0, 0, {}, -1};
+        for (int r = 0; r < rounds; r++)
+            replay(records, res);
+
+        std::vector<uint32_t> &lat = res.latency_ns;
+        std::sort(lat.begin(), lat.end());
+        size_t n = lat.size();
+        double rate = res.total_ns > 0 ? res.keys * 1e9 / res.total_ns : 0;
+
+        const char *name = strrchr(files[f], '/') ? strrchr(files[f], '/') + 1 : files[f];
+        printf("%-24s %8zu %8zu %12.0f", name, res.events / rounds, res.keys / rounds, rate);
+        if (n > 0)
+            printf(" %8.2f %8.2f %8.2f", lat[n / 2] / 1000.0, lat[n * 99 / 100] / 1000.0, lat[n - 1] / 1000.0);
+        else
+            printf(" %8s %8s %8s", "-", "-", "-");
+
+        if (!check_output)
+            printf("  not checked\n");
+        else if (res.mismatch < 0)
+            printf("  match\n");
+        else
+            printf("  differs at byte %ld\n", res.mismatch);
+
+        if ((check_output && res.mismatch >= 0) || rate < min_rate)
+            ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
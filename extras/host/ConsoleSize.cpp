@@ -0,0 +1,28 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* Sketch-like program to compare the linked code size of feature configurations,
+   see the report target in the Makefile. */
+
+#include <Arduino.h>
+#include <ConsoleInput.h>
+#include "ScriptedStream.h"
+
+static void parser(const char *line)
+{
+    printf("%s\n", line);
+}
+
+int main()
+{
+    ScriptedStream stream;
+    StaticConsoleInput<128, 512> console(&stream);
+    console.setLineCallback(parser);
+
+    stream.script("help\r");
+    stream.release();
+    while (stream.available() > 0)
+        console.poll();
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* ConsoleNotifier for host builds, a condition variable with a pending flag
+   so a notification before wait() is not lost. */
+
+#ifndef _HOSTNOTIFIER_H
+#define _HOSTNOTIFIER_H
+
+#include <ConsoleNotifier.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+class HostNotifier : public ConsoleNotifier
+{
+public:
+  virtual bool wait(uint32_t timeout_ms)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool woken = signal.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return pending; });
+    pending = false;
+    return woken;
+  }
+
+  virtual void notify(void)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending = true;
+    }
+    signal.notify_one();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable signal;
+  bool pending = false;
+};
+
+#endif
@@ -0,0 +1,194 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* Stress test of ConsoleRing as the input of ConsoleInput on a Linux host.
+
+   A producer thread pushes numbered command lines into the ring in UART-sized
+   bursts, paced at the given baud rate (argv[1], default 921600) for the given
+   number of lines (argv[2], default 20000). The main thread is the consumer:
+   it decodes the ring with ConsoleInput and checks that every line arrives
+   intact. The consumer runs twice, spinning on readKey() and sleeping in
+   waitKey() until the producer notifies it. The ring holds 44 ms of input at
+   921600 baud, longer than a scheduler time slice. On a single-CPU host the
+   spinning consumer sleeps 100 us when the ring is empty instead of yielding,
+   a yield does not let a producer that just woke up run. A final check covers
+   rings without room and sizes that are not a power of two.
+
+   Reported are lost or corrupted lines, ring overflows, the CPU time of the
+   consumer and the latency from the arrival of a byte until it was processed,
+   sampled for the bytes read outside of waitKey(). */
+
+#include <Arduino.h>
+#include <ConsoleInput.h>
+#include <ConsoleRing.h>
+#include "HostNotifier.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+// Discards the console output
+class NullStream : public Stream
+{
+public:
+  virtual int available(void) { return 0; }
+  virtual int peek(void) { return -1; }
+  virtual int read(void) { return -1; }
+  virtual size_t write(uint8_t) { return 1; }
+  virtual size_t write(const uint8_t *, size_t size) { return size; }
+};
+
+static std::atomic<bool> producer_done(false);
+static size_t lines_ok = 0;
+static size_t lines_bad = 0;
+
+static std::string make_line(size_t n)
+{
+    return "set channel " + std::to_string(n) + " gain " + std::to_string(n * 7 % 1000);
+}
+
+// A line is intact when it matches the line generated for its own number
+static void check_line(const char *line)
+{
+    unsigned long n;
+    if (sscanf(line, "set channel %lu", &n) == 1 && make_line(n) == line)
+        lines_ok++;
+    else
+        lines_bad++;
+}
+
+static void producer(ConsoleRing *ring, long baud, size_t lines)
+{
+    const size_t burst = 16; // UART FIFO threshold
+    std::chrono::nanoseconds per_burst((long long)burst * 10 * 1000000000LL / baud);
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+    std::string pending;
+    for (size_t n = 0; n < lines || !pending.empty();)
+    {
+        while (pending.size() < burst && n < lines)
+            pending += make_line(n++) + "\r";
+
+        // like a UART interrupt, bytes that do not fit are lost
+        size_t count = std::min(pending.size(), burst);
+        ring->push((const uint8_t *)pending.data(), count, micros());
+        pending.erase(0, count);
+
+        next += per_burst;
+        std::this_thread::sleep_until(next);
+    }
+    producer_done = true;
+}
+
+static double thread_cpu_ms()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+static bool run(bool wait, long baud, size_t lines)
+{
+    static uint8_t ring_data[4096];
+    static uint32_t ring_stamps[4096];
+    bool single_cpu = std::thread::hardware_concurrency() == 1;
+    ConsoleRing ring(ring_data, sizeof(ring_data), ring_stamps);
+    HostNotifier notifier;
+
+    NullStream out;
+    ConsoleInput console(&out, 128);
+    console.setInput(&ring);
+    console.setLineCallback(check_line);
+    if (wait)
+    {
+        ring.setNotifier(&notifier);
+        console.setNotifier(&notifier);
+    }
+
+    std::vector<uint32_t> latency;
+    latency.reserve(lines * 32);
+    lines_ok = 0;
+    lines_bad = 0;
+    producer_done = false;
+
+    double cpu = thread_cpu_ms();
+    std::thread thread(producer, &ring, baud, lines);
+    while (!producer_done || ring.available() > 0)
+    {
+        if (ring.available() == 0)
+        {
+            if (wait)
+                console.waitKey(100);
+            else if (single_cpu)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            else
+                std::this_thread::yield();
+            continue;
+        }
+
+        uint32_t arrived = ring.arrival();
+        console.readKey();
+        latency.push_back(micros() - arrived);
+    }
+    thread.join();
+    cpu = thread_cpu_ms() - cpu;
+
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+
+    printf("%-14s %10zu %10zu %10zu %10zu %10.0f", wait ? "waitKey" : "readKey spin", n, lines_ok,
+           lines - lines_ok, ring.overflows(), cpu);
+    if (n > 0)
+        printf(" %8u %8u %8u", latency[n / 2], latency[n * 99 / 100], latency[n - 1]);
+    printf("\n");
+
+    return lines_ok == lines && ring.overflows() == 0;
+}
+
+// A ring without room holds nothing and counts every byte as an overflow,
+// other sizes are rounded down to a power of two
+static bool check_sizes()
+{
+    static uint8_t buf[100];
+    static uint32_t stamps[100];
+    const uint8_t bytes[3] = {'a', 'b', 'c'};
+
+    bool ok = true;
+    for (int i = 0; i < 2; i++)
+    {
+        ConsoleRing ring(i == 0 ? NULL : buf, i == 0 ? sizeof(buf) : 0, stamps);
+        size_t pushed = ring.push(bytes, sizeof(bytes), 1) + ring.push('d', 2);
+        ok = ok && pushed == 0 && ring.overflows() == 4 && ring.available() == 0 && ring.capacity() == 0;
+    }
+
+    ConsoleRing ring(buf, sizeof(buf), stamps);
+    ok = ok && ring.capacity() == 64;
+
+    printf("%-14s %s\n", "ring sizes", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    long baud = argc > 1 ? atol(argv[1]) : 921600;
+    size_t lines = argc > 2 ? (size_t)atol(argv[2]) : 20000;
+    if (baud <= 0)
+        baud = 921600;
+
+    printf("ConsoleRing stress test, %zu lines at %ld baud, latency in us\n\n", lines, baud);
+    printf("%-14s %10s %10s %10s %10s %10s %8s %8s %8s\n", "consumer", "samples", "lines ok", "lines lost",
+           "overflows", "cpu(ms)", "p50", "p99", "max");
+
+    bool ok = run(false, baud, lines);
+    ok = run(true, baud, lines) && ok;
+    printf("\n");
+    ok = check_sizes() && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* In-memory Stream for host builds. Input is a script of bytes that is
+   released to the reader in bursts, output is captured and counted. */
+
+#ifndef _SCRIPTEDSTREAM_H
+#define _SCRIPTEDSTREAM_H
+
+#include <Arduino.h>
+#include <string>
+
+class ScriptedStream : public Stream
+{
+public:
+  // Queue bytes for input, visible to the reader after release()
+  void script(const char *data, size_t len) { input.append(data, len); }
+  void script(const char *str) { input.append(str); }
+  void script(const std::string &str) { input.append(str); }
+
+  // Make the next count scripted bytes available, or all of them
+  void release(size_t count = (size_t)-1)
+  {
+    size_t left = input.size() - released;
+    released += count < left ? count : left;
+  }
+
+  bool exhausted() const { return read_pos >= input.size(); }
+  size_t pending() const { return input.size() - read_pos; }
+
+  void reset()
+  {
+    input.clear();
+    output.clear();
+    read_pos = released = 0;
+    write_calls = 0;
+    overrun = 0;
+  }
+
+  void clearOutput()
+  {
+    output.clear();
+    write_calls = 0;
+  }
+
+  // Simulated transmit buffer: availableForWrite() returns the free space, which
+  // drainWrite() frees again like a UART sending bytes at its line rate
+  void limitWrite(size_t space)
+  {
+    tx_limited = true;
+    tx_space = space;
+  }
+  void drainWrite(size_t count) { tx_space += count; }
+
+  // Captured output and the number of write() calls that produced it
+  std::string output;
+  size_t write_calls = 0;
+  size_t overrun = 0; // bytes written without space, a real stream would have blocked
+
+  virtual int available(void) { return (int)(released - read_pos); }
+
+  virtual int peek(void) { return read_pos < released ? (uint8_t)input[read_pos] : -1; }
+
+  virtual int read(void) { return read_pos < released ? (uint8_t)input[read_pos++] : -1; }
+
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    write_calls++;
+    output.append((const char *)buffer, size);
+    if (tx_limited)
+    {
+      size_t room = size < tx_space ? size : tx_space;
+      overrun += size - room;
+      tx_space -= room;
+    }
+    return size;
+  }
+
+  virtual int availableForWrite() { return tx_limited ? (int)tx_space : 256; }
+
+  using Print::write;
+
+private:
+  std::string input;
+  size_t read_pos = 0;
+  bool tx_limited = false;
+  size_t tx_space = 0;
+  size_t released = 0;
+};
+
+#endif
@@ -0,0 +1,481 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* Telnet console server for host builds, an epoll loop serving ConsoleTelnet
+   sessions from one ConsoleServer.
+
+     TelnetServer [-p port]              serve until interrupted, try telnet localhost 2323
+     TelnetServer -l sessions [-n cmds]  load test over loopback
+
+   The commands are "echo", "size" (the window size reported by NAWS),
+   "sessions" and "quit". In load test mode a client thread opens the sessions,
+   negotiates character mode and a 120 x 40 window like a telnet client, checks
+   the size and then runs echo commands on all sessions at once. Reported:
+     cmds/s     echo commands completed per second
+     p50/p99/max  latency from sending a command until its output arrived, in us
+     cpu/cmd    CPU time of the server loop per command, in us
+   The exit status is non-zero when a session failed. */
+
+#include <Arduino.h>
+#include <ConsoleInput.h>
+#include <ConsoleServer.h>
+#include <ConsoleTelnet.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock load_clock;
+
+static const size_t MAX_SESSIONS = 256;
+static const size_t LINE_SIZE = 128;
+static const size_t HISTORY_SIZE = 4096;
+static const uint16_t HISTORY_ENTRIES = 64;
+
+// Non-blocking socket, the input is filled by the epoll loop, output that does not fit in the
+// socket buffer is queued and sent by the loop. Like the send buffer of a network stack the
+// queue is limited, write() accepts at most availableForWrite() bytes.
+class SocketStream : public Stream
+{
+public:
+  static const size_t OUTPUT_LIMIT = 65536;
+
+  int fd = -1;
+  std::string input;
+  size_t input_pos = 0;
+  std::string output;
+
+  // Receive everything available, false when the peer closed the connection
+  bool fill()
+  {
+      if (input_pos == input.size())
+      {
+          input.clear();
+          input_pos = 0;
+      }
+
+      char buf[4096];
+      for (;;)
+      {
+          ssize_t n = recv(fd, buf, sizeof(buf), 0);
+          if (n > 0)
+              input.append(buf, n);
+          else if (n == 0)
+              return false;
+          else
+              return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      }
+  }
+
+  // Send queued output, false on an error
+  bool drain()
+  {
+      while (!output.empty())
+      {
+          ssize_t n = send(fd, output.data(), output.size(), MSG_NOSIGNAL);
+          if (n < 0)
+              return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+          output.erase(0, n);
+      }
+      return true;
+  }
+
+  virtual int available(void) { return (int)(input.size() - input_pos); }
+  virtual int peek(void) { return input_pos < input.size() ? (uint8_t)input[input_pos] : -1; }
+  virtual int read(void) { return input_pos < input.size() ? (uint8_t)input[input_pos++] : -1; }
+
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+      size_t count = std::min(size, (size_t)availableForWrite());
+      output.append((const char *)buffer, count);
+      return count;
+  }
+
+  virtual int availableForWrite() { return output.size() < OUTPUT_LIMIT ? (int)(OUTPUT_LIMIT - output.size()) : 0; }
+
+  using Print::write;
+};
+
+struct Connection
+{
+    SocketStream socket;
+    ConsoleTelnet telnet;
+    ConsoleInput *console;
+    bool quit;
+};
+
+static uint8_t arena[MAX_SESSIONS * 1024 + 8192];
+static ConsoleServer *server;
+static std::map<int, Connection *> connections;
+static std::atomic<bool> running(true);
+static size_t max_sessions = 0;
+
+// ======== Commands =========================
+
+static Connection *current_connection()
+{
+    ConsoleInput *console = server->current();
+    for (std::map<int, Connection *>::iterator it = connections.begin(); it != connections.end(); ++it)
+        if (it->second->console == console)
+            return it->second;
+    return NULL;
+}
+
+static void cmd_echo(int argc, char *argv[])
+{
+    ConsoleInput *console = server->current();
+    console->println();
+    console->print('=');
+    for (int i = 1; i < argc; i++)
+    {
+        console->print(argv[i]);
+        console->print(i + 1 < argc ? " " : "");
+    }
+    console->println();
+}
+
+static void cmd_quit(int argc, char *argv[])
+{
+    Connection *conn = current_connection();
+    if (conn != NULL)
+        conn->quit = true;
+}
+
+static void cmd_sessions(int argc, char *argv[])
+{
+    server->current()->println();
+    server->current()->printf("=%zu of %zu\r\n", server->count(), server->capacity());
+}
+
+static void cmd_size(int argc, char *argv[])
+{
+    ConsoleInput *console = server->current();
+    console->println();
+    console->printf("=%ux%u\r\n", console->getColumns(), console->getRows());
+}
+
+static const ConsoleCommand commands[] = {
+    {"echo", cmd_echo},
+    {"quit", cmd_quit},
+    {"sessions", cmd_sessions},
+    {"size", cmd_size},
+};
+
+// ======== Server =========================
+
+static int listen_on(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0)
+    {
+        perror("listen");
+        exit(1);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static uint16_t port_of(int fd)
+{
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+static void accept_all(int listener, int ep)
+{
+    for (;;)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+            return;
+
+        Connection *conn = new Connection();
+        conn->socket.fd = fd;
+        conn->console = server->open(&conn->telnet);
+        if (conn->console == NULL)
+        {
+            const char full[] = "server full\r\n";
+            send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL);
+            close(fd);
+            delete conn;
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        conn->quit = false;
+        conn->telnet.begin(&conn->socket);
+        conn->telnet.setConsole(conn->console);
+        conn->console->setCommands(commands, sizeof(commands) / sizeof(commands[0]));
+        conn->console->setPrompt("host> ");
+        connections[fd] = conn;
+        max_sessions = std::max(max_sessions, connections.size());
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+static void close_connection(int ep, Connection *conn)
+{
+    epoll_ctl(ep, EPOLL_CTL_DEL, conn->socket.fd, NULL);
+    close(conn->socket.fd);
+    server->close(conn->console);
+    connections.erase(conn->socket.fd);
+    delete conn;
+}
+
+static double thread_cpu_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Serve until running is cleared, returns the CPU time of the loop in us
+static double serve(int listener)
+{
+    int ep = epoll_create1(0);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+    double cpu = thread_cpu_us();
+    epoll_event events[64];
+    while (running)
+    {
+        int n = epoll_wait(ep, events, 64, 5);
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listener)
+            {
+                accept_all(listener, ep);
+                continue;
+            }
+
+            std::map<int, Connection *>::iterator it = connections.find(fd);
+            if (it != connections.end() && !it->second->socket.fill())
+                close_connection(ep, it->second);
+        }
+
+        server->poll();
+
+        std::vector<Connection *> done;
+        for (std::map<int, Connection *>::iterator it = connections.begin(); it != connections.end(); ++it)
+            if (!it->second->socket.drain() || it->second->quit)
+                done.push_back(it->second);
+        for (size_t i = 0; i < done.size(); i++)
+            close_connection(ep, done[i]);
+    }
+    cpu = thread_cpu_us() - cpu;
+
+    while (!connections.empty())
+        close_connection(ep, connections.begin()->second);
+    close(ep);
+    return cpu;
+}
+
+// ======== Load Test =========================
+
+struct Client
+{
+    int fd;
+    std::string received;
+    std::string expect; // output that completes the current command
+    load_clock::time_point sent;
+    int done;
+};
+
+static std::vector<uint32_t> latency;
+static size_t failed = 0;
+
+static bool send_all(int fd, const std::string &data)
+{
+    return send(fd, data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t)data.size();
+}
+
+// Send the next command of a client, the first one checks the negotiated window size
+static void next_command(Client &c, int index)
+{
+    std::string line;
+    if (c.done == 0)
+    {
+        line = "size";
+        c.expect = "=120x40";
+    }
+    else
+    {
+        line = "echo " + std::to_string(index) + " " + std::to_string(c.done);
+        c.expect = "=" + std::to_string(index) + " " + std::to_string(c.done) + "\r\n";
+    }
+    c.received.clear();
+    c.sent = load_clock::now();
+    line.append("\r\0", 2); // Enter in character mode
+    if (!send_all(c.fd, line))
+        c.done = -1;
+}
+
+static void load(uint16_t port, size_t sessions, int commands, double &seconds)
+{
+    // what a telnet client answers to the server, and its window size
+    static const uint8_t hello[] = {255, 253, 1,  255, 253, 3,  255, 251, 3,   255, 251,
+                                    31,  255, 250, 31, 0,   120, 0, 40,  255, 240};
+
+    std::vector<Client> clients(sessions);
+    int ep = epoll_create1(0);
+    for (size_t i = 0; i < sessions; i++)
+    {
+        Client &c = clients[i];
+        c.fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (connect(c.fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("connect");
+            exit(1);
+        }
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        send_all(c.fd, std::string((const char *)hello, sizeof(hello)));
+        c.done = 0;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    load_clock::time_point start = load_clock::now();
+    for (size_t i = 0; i < sessions; i++)
+        next_command(clients[i], i);
+
+    size_t active = sessions;
+    epoll_event events[64];
+    while (active > 0)
+    {
+        int n = epoll_wait(ep, events, 64, 2000);
+        if (n == 0)
+            break; // a session stopped answering
+
+        for (int e = 0; e < n; e++)
+        {
+            size_t i = events[e].data.u64;
+            Client &c = clients[i];
+            char buf[4096];
+            ssize_t len = recv(c.fd, buf, sizeof(buf), 0);
+            if (len <= 0 || c.done < 0 || c.done > commands)
+                continue;
+
+            c.received.append(buf, len);
+            if (c.received.find(c.expect) == std::string::npos)
+                continue;
+
+            if (c.done > 0)
+                latency.push_back(std::chrono::duration_cast<std::chrono::microseconds>(load_clock::now() - c.sent).count());
+            if (++c.done > commands)
+            {
+                active--;
+                continue;
+            }
+            next_command(c, i);
+        }
+    }
+    seconds = std::chrono::duration<double>(load_clock::now() - start).count();
+
+    for (size_t i = 0; i < sessions; i++)
+    {
+        if (clients[i].done <= commands)
+            failed++;
+        close(clients[i].fd);
+    }
+    close(ep);
+}
+
+int main(int argc, char *argv[])
+{
+    uint16_t port = 2323;
+    size_t sessions = 0;
+    int commands = 100;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-p") == 0)
+            port = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-l") == 0)
+            sessions = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0)
+            commands = atoi(argv[i + 1]) > 0 ? atoi(argv[i + 1]) : 1;
+    }
+    sessions = std::min(sessions, MAX_SESSIONS);
+
+    ConsoleServer console_server(arena, sizeof(arena), LINE_SIZE, HISTORY_SIZE, HISTORY_ENTRIES, true);
+    server = &console_server;
+
+    if (sessions == 0)
+    {
+        int listener = listen_on(port);
+        printf("Telnet console on localhost port %u, %zu sessions of %zu bytes\n", port_of(listener),
+               server->capacity(), ConsoleServer::sessionSize(LINE_SIZE, HISTORY_SIZE, HISTORY_ENTRIES, true));
+        serve(listener);
+        return 0;
+    }
+
+    int listener = listen_on(0);
+    double seconds = 0;
+    std::thread client([&] {
+        load(port_of(listener), sessions, commands, seconds);
+        running = false;
+    });
+    double cpu = serve(listener);
+    client.join();
+    close(listener);
+
+    printf("Telnet load test, %zu sessions, %d echo commands each\n\n", sessions, commands);
+    printf("%-10s %10s %10s %12s %8s %8s %8s %10s\n", "sessions", "commands", "failed", "cmds/s", "p50", "p99",
+           "max", "cpu/cmd");
+
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    printf("%-10zu %10zu %10zu %12.0f", max_sessions, n, failed, seconds > 0 ? n / seconds : 0);
+    if (n > 0)
+        printf(" %8u %8u %8u %10.2f", latency[n / 2], latency[n * 99 / 100], latency[n - 1], cpu / n);
+    printf("\n");
+
+    return failed == 0 && max_sessions == sessions ? 0 : 1;
+}
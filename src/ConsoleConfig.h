@@ -0,0 +1,59 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+/* Compile-time feature selection. Define any of these as 0 in the build flags,
+   e.g. -DCONSOLE_DEBUG=0, to remove the feature from flash and from the per-key path.
+   CONSOLE_STATS is off unless it is defined as 1. */
+
+#ifndef _CONSOLECONFIG_H
+#define _CONSOLECONFIG_H
+
+#ifndef CONSOLE_DEBUG
+#define CONSOLE_DEBUG 1 // setDebug(), escape sequence and buffer dumps
+#endif
+
+#ifndef CONSOLE_HISTORY
+#define CONSOLE_HISTORY 1 // command history, reverse search and prefix recall
+#endif
+
+#ifndef CONSOLE_AUTO_EDIT
+#define CONSOLE_AUTO_EDIT 1 // typed characters, backspace, delete and TAB edit the line
+#endif
+
+#ifndef CONSOLE_AUTO_MOVE
+#define CONSOLE_AUTO_MOVE 1 // arrow, Home and End keys move the caret
+#endif
+
+#ifndef CONSOLE_FUNCTION_KEYS
+#define CONSOLE_FUNCTION_KEYS 1 // decode F1-F12, otherwise they return KEY_UNKNOWN
+#endif
+
+#ifndef CONSOLE_PASTE
+#define CONSOLE_PASTE 1 // bracketed paste, pasted text is inserted in bulk and redrawn once
+#endif
+
+#ifndef CONSOLE_PASSTHROUGH
+#define CONSOLE_PASSTHROUGH 1 // binary blocks passed to the application without decoding
+#endif
+
+#ifndef CONSOLE_REDRAW
+#define CONSOLE_REDRAW 1 // draw the prompt and line on the terminal
+#endif
+
+#ifndef CONSOLE_STATS
+#define CONSOLE_STATS 0 // counters and execution time histograms, see ConsoleInput::getStats()
+#endif
+
+#ifndef CONSOLE_STATS_BUCKETS
+#define CONSOLE_STATS_BUCKETS 8 // histogram buckets, each covers 4 times the time of the previous one
+#endif
+
+#ifndef CONSOLE_FRAME_SIZE
+#define CONSOLE_FRAME_SIZE 64 // bytes of terminal output collected before a bulk write
+#endif
+
+#ifndef CONSOLE_MAX_ARGS
+#define CONSOLE_MAX_ARGS 16 // maximum number of arguments passed to a command handler
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleFrame.h"
+
+ConsoleFrame::ConsoleFrame(Print *out)
+{
+    target = out;
+    queue = frame_buf;
+    size = sizeof(frame_buf);
+    len = 0;
+    committed = 0;
+    locked = 0;
+    high_water = 0;
+    dropped = false;
+    flow = false;
+#if CONSOLE_STATS
+    memset(&counters, 0, sizeof(counters));
+#endif
+}
+
+void ConsoleFrame::setTarget(Print *out)
+{
+    flush();
+
+    // what the old target did not accept is lost
+    len = 0;
+    committed = 0;
+    locked = 0;
+    target = out;
+    flow = false;
+}
+
+// Queue output without blocking, a NULL buffer returns to blocking writes
+// The buffer must hold at least a complete redraw of the prompt and the line
+void ConsoleFrame::setQueue(uint8_t *buffer, size_t bytes)
+{
+    flush();
+
+    uint8_t *rest = queue;
+    if (buffer != NULL && bytes > 0)
+    {
+        queue = buffer;
+        size = bytes;
+    }
+    else
+    {
+        queue = frame_buf;
+        size = sizeof(frame_buf);
+    }
+
+    // bytes the target did not accept move along when they fit
+    if (len > size)
+        len = 0;
+    memmove(queue, rest, len);
+    committed = len;
+    locked = len;
+    high_water = 0;
+}
+
+bool ConsoleFrame::isNonBlocking(void)
+{
+    return queue != frame_buf;
+}
+
+// Number of bytes waiting to be written
+size_t ConsoleFrame::pending(void)
+{
+    return len;
+}
+
+// Largest number of bytes that were waiting in the queue
+size_t ConsoleFrame::highWater(void)
+{
+    return high_water;
+}
+
+size_t ConsoleFrame::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ConsoleFrame::write(const uint8_t *buffer, size_t count)
+{
+    // the rest of a dropped frame is discarded too
+    if (dropped)
+        return count;
+
+    if (len + count > size)
+    {
+        if (!isNonBlocking())
+        {
+            flush();
+
+            // larger than the frame, or the target refused the rest, pass it straight through
+            if (len + count > size)
+                return put(buffer, count, true);
+        }
+        else
+        {
+            drain();
+            if (len + count > size)
+            {
+                // keep the frame that is on its way, the terminal needs all of it
+                len = locked;
+                committed = locked;
+                dropped = true;
+#if CONSOLE_STATS
+                counters.dropped++;
+#endif
+                return count;
+            }
+        }
+    }
+
+    memcpy(queue + len, buffer, count);
+    len += count;
+    if (len > high_water)
+        high_water = len;
+    return count;
+}
+
+// Write to the target, counting writes that may have to wait for room
+size_t ConsoleFrame::put(const uint8_t *buffer, size_t count, bool blocking)
+{
+    if (target == NULL)
+        return 0;
+
+#if CONSOLE_STATS
+    if (blocking && (size_t)target->availableForWrite() < count)
+        counters.blocked++;
+    counters.bytes += count;
+#endif
+    return target->write(buffer, count);
+}
+
+// Write the complete frames as far as the target accepts them without blocking
+void ConsoleFrame::drain(void)
+{
+    if (target == NULL || committed == 0)
+        return;
+
+    int space = target->availableForWrite();
+    if (space > 0)
+        flow = true;
+    else if (!flow)
+        space = committed; // no flow control, write like a blocking target
+    else
+        return;
+
+    size_t count = committed < (size_t)space ? committed : (size_t)space;
+    count = put(queue, count, false);
+    if (count == 0)
+        return;
+
+    memmove(queue, queue + count, len - count);
+    len -= count;
+    committed -= count;
+    locked = committed;
+}
+
+// End the frame and write it, returns false if (part of) the frame was dropped
+bool ConsoleFrame::send(void)
+{
+    bool complete = !dropped;
+    dropped = false;
+
+    committed = len;
+    if (isNonBlocking())
+        drain();
+    else
+        flush();
+    return complete;
+}
+
+// Write all collected bytes to the target, this blocks until the target accepted them
+// Bytes a target refuses to accept stay queued, the target itself is not flushed
+void ConsoleFrame::flush(void)
+{
+    size_t written = 0;
+    while (written < len)
+    {
+        size_t count = put(queue + written, len - written, true);
+        if (count == 0)
+            break;
+        written += count;
+    }
+
+    memmove(queue, queue + written, len - written);
+    len -= written;
+    committed = len;
+    locked = len;
+}
@@ -0,0 +1,64 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLEFRAME_H
+#define _CONSOLEFRAME_H
+
+#include <Arduino.h>
+#include "ConsoleConfig.h"
+
+// Print that collects terminal output in a small fixed buffer
+// The buffer is written to the target with a single bulk write when it is full
+// or when the frame is sent, so a redraw becomes one packet on USB-CDC or TCP.
+//
+// With a queue the output never blocks: a frame is only written as far as
+// availableForWrite() of the target allows and the rest is sent later. When
+// the queue overflows, the frames that were not started yet are dropped and
+// send() returns false, so the caller can replace them with a full redraw.
+// A target that never reports space in availableForWrite(), like the default
+// of Print, is written blocking.
+class ConsoleFrame : public Print
+{
+
+private:
+  Print *target;
+  uint8_t *queue;      // frame_buf or the queue of the non-blocking mode
+  size_t size;         // size of queue
+  size_t len;          // bytes in queue
+  size_t committed;    // bytes of complete frames, the rest is the frame being built
+  size_t locked;       // bytes of committed frames that were partly written
+  size_t high_water;   // largest number of bytes queued
+  bool dropped;        // the frame being built was dropped
+  bool flow;           // the target reported space for writing, until then drain() blocks
+  uint8_t frame_buf[CONSOLE_FRAME_SIZE];
+
+  void drain(void);
+  size_t put(const uint8_t *buffer, size_t count, bool blocking);
+
+public:
+#if CONSOLE_STATS
+  struct
+  {
+    uint32_t bytes;   // bytes written to the target
+    uint32_t blocked; // blocking writes larger than availableForWrite()
+    uint32_t dropped; // frames dropped from a full queue
+  } counters;
+#endif
+
+  ConsoleFrame(Print *out = NULL);
+
+  void setTarget(Print *out);
+  void setQueue(uint8_t *buffer, size_t size);
+  bool isNonBlocking(void);
+  size_t pending(void);
+  size_t highWater(void);
+  bool send(void);
+
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual void flush(void);
+
+  using Print::write;
+};
+
+#endif
@@ -0,0 +1,316 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleHistory.h"
+
+const uint16_t ConsoleHistory::NO_MATCH;
+
+// ======== Constructors =======================
+
+ConsoleHistory::ConsoleHistory(size_t size, uint16_t entries, bool search)
+{
+    // offsets are 16-bit
+    if (size > 0xffff)
+        size = 0xffff;
+
+    char *buffer = NULL;
+    uint16_t *words = NULL;
+    if (size > 0 && entries > 0)
+    {
+        buffer = (char *)malloc(size);
+        words = (uint16_t *)malloc(indexWords(entries, search) * sizeof(uint16_t));
+    }
+
+    if (buffer == NULL || words == NULL)
+    {
+        free(buffer);
+        free(words);
+        buffer = NULL;
+        words = NULL;
+    }
+
+    init(buffer, size, words, entries, search);
+    owns_memory = true;
+}
+
+ConsoleHistory::ConsoleHistory(char *buffer, size_t size, uint16_t *words, uint16_t entries, bool search)
+{
+    if (size > 0xffff)
+        size = 0xffff;
+
+    init(buffer, size, words, entries, search);
+    owns_memory = false;
+}
+
+ConsoleHistory::~ConsoleHistory()
+{
+    if (!owns_memory)
+        return;
+
+    free(buf);
+    free(index);
+}
+
+size_t ConsoleHistory::indexWords(uint16_t entries, bool search)
+{
+    // offset, plus prefix and a slot/position pair for searching
+    return (size_t)entries * (search ? 4 : 1);
+}
+
+void ConsoleHistory::init(char *buffer, size_t size, uint16_t *words, uint16_t entries, bool search)
+{
+    bool valid = buffer != NULL && words != NULL && size > 0 && entries > 0;
+
+    buf = valid ? buffer : NULL;
+    index = valid ? words : NULL;
+    prefix = valid && search ? words + entries : NULL;
+    matches = valid && search ? words + 2 * entries : NULL;
+    buf_size = valid ? size : 0;
+    max_count = valid ? entries : 0;
+    clear();
+}
+
+void ConsoleHistory::clear()
+{
+    first = 0;
+    num = 0;
+    head = 0;
+    used = 0;
+    match_count = 0;
+    searcher = NULL;
+}
+
+// ======== Entries =========================
+
+// Index slot of an entry, 0 is the most recent entry
+inline uint16_t ConsoleHistory::slot(uint16_t entry)
+{
+    uint16_t pos = first + num - 1 - entry;
+    return pos >= max_count ? pos - max_count : pos;
+}
+
+// Entry number of an index slot
+inline uint16_t ConsoleHistory::entry(uint16_t slot)
+{
+    uint16_t newest = this->slot(0);
+    return newest >= slot ? newest - slot : newest + max_count - slot;
+}
+
+// Character at a position relative to a start offset in the byte ring
+inline char ConsoleHistory::ring(uint16_t start, size_t pos)
+{
+    pos += start;
+    return buf[pos >= buf_size ? pos - buf_size : pos];
+}
+
+uint16_t ConsoleHistory::count()
+{
+    return num;
+}
+
+// Start position of an entry in the byte ring
+size_t ConsoleHistory::offset(uint16_t entry)
+{
+    if (entry >= num)
+        return 0;
+
+    return index[slot(entry)];
+}
+
+size_t ConsoleHistory::length(uint16_t entry)
+{
+    if (entry >= num)
+        return 0;
+
+    uint16_t start = index[slot(entry)];
+    uint16_t end = entry == 0 ? head : index[slot(entry - 1)];
+    size_t len = end >= start ? end - start : end + buf_size - start;
+
+    // entries are never empty, so a zero length is one entry filling the ring
+    return len == 0 ? buf_size : len;
+}
+
+char ConsoleHistory::charAt(uint16_t entry, size_t pos)
+{
+    if (pos >= length(entry))
+        return 0;
+
+    return ring(index[slot(entry)], pos);
+}
+
+// Copy an entry to dst, up to max characters, and return the number of characters copied
+size_t ConsoleHistory::copy(uint16_t entry, char *dst, size_t max)
+{
+    size_t len = length(entry);
+    if (len > max)
+        len = max;
+    if (len == 0)
+        return 0;
+
+    size_t start = index[slot(entry)];
+    size_t part = buf_size - start;
+    if (part > len)
+        part = len;
+
+    memcpy(dst, buf + start, part);
+    memcpy(dst + part, buf, len - part);
+    return len;
+}
+
+// ======== Adding Entries =========================
+
+// Drop the oldest entry
+inline void ConsoleHistory::evict()
+{
+    forget(first);
+    used -= length(num - 1);
+    first = first + 1 >= max_count ? 0 : first + 1;
+    num--;
+}
+
+// Add a line as the most recent entry, empty lines and repeats of the last entry are skipped
+bool ConsoleHistory::push(const char *line, size_t len)
+{
+    if (line == NULL || len == 0 || len > buf_size)
+        return false;
+
+    // duplicate suppression
+    if (num > 0 && length(0) == len && compare(index[slot(0)], 0, line, len))
+        return false;
+
+    while (num > 0 && (num >= max_count || used + len > buf_size))
+        evict();
+
+    if (num == 0)
+        head = 0;
+
+    uint16_t pos = first + num;
+    pos = pos >= max_count ? pos - max_count : pos;
+    index[pos] = head;
+    if (prefix != NULL)
+        prefix[pos] = (uint8_t)line[0] | (len > 1 ? (uint8_t)line[1] << 8 : 0);
+    num++;
+
+    size_t part = buf_size - head;
+    if (part > len)
+        part = len;
+    memcpy(buf + head, line, part);
+    memcpy(buf, line + part, len - part);
+
+    head = head + len >= buf_size ? head + len - buf_size : head + len;
+    used += len;
+    return true;
+}
+
+// ======== Searching =========================
+
+// Compare text with the byte ring, starting at a position of an entry
+inline bool ConsoleHistory::compare(uint16_t start, size_t pos, const char *text, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (ring(start, pos + i) != text[i])
+            return false;
+    return true;
+}
+
+// First position of a pattern in the entry at an index slot, starting at from
+uint16_t ConsoleHistory::find(uint16_t slot, size_t from, const char *pattern, size_t len)
+{
+    size_t entry_len = length(entry(slot));
+    uint16_t start = index[slot];
+
+    for (size_t pos = from; pos + len <= entry_len; pos++)
+        if (compare(start, pos, pattern, len))
+            return pos;
+
+    return NO_MATCH;
+}
+
+// Remove an index slot that is about to be reused from the search matches
+void ConsoleHistory::forget(uint16_t slot)
+{
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < match_count; i++)
+    {
+        if (matches[2 * i] == slot)
+            continue;
+        matches[2 * kept] = matches[2 * i];
+        matches[2 * kept + 1] = matches[2 * i + 1];
+        kept++;
+    }
+    match_count = kept;
+}
+
+// Find the entries containing pattern and return the number of matches
+// With narrow set, pattern must extend the previous pattern and only the
+// previous matches are checked, each from its previous match position on
+uint16_t ConsoleHistory::search(const char *pattern, size_t len, bool narrow, const void *owner)
+{
+    if (matches == NULL)
+        return 0;
+
+    searcher = owner;
+
+    if (!narrow)
+    {
+        match_count = 0;
+        for (uint16_t i = 0; i < num; i++)
+        {
+            uint16_t pos = find(slot(i), 0, pattern, len);
+            if (pos == NO_MATCH)
+                continue;
+            matches[2 * match_count] = slot(i);
+            matches[2 * match_count + 1] = pos;
+            match_count++;
+        }
+        return match_count;
+    }
+
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < match_count; i++)
+    {
+        uint16_t pos = find(matches[2 * i], matches[2 * i + 1], pattern, len);
+        if (pos == NO_MATCH)
+            continue;
+        matches[2 * kept] = matches[2 * i];
+        matches[2 * kept + 1] = pos;
+        kept++;
+    }
+    match_count = kept;
+    return match_count;
+}
+
+// True when the matches are those of the last search by owner, a history shared by
+// several consoles has one list of matches
+bool ConsoleHistory::searchedBy(const void *owner)
+{
+    return searcher == owner;
+}
+
+// Entry number of a search match, the most recent match is 0
+uint16_t ConsoleHistory::match(uint16_t num)
+{
+    if (num >= match_count)
+        return NO_MATCH;
+
+    return entry(matches[2 * num]);
+}
+
+// Find the nearest entry from 'from' on that starts with text, moving to older or newer entries
+// The prefix index rejects most entries without reading the byte ring
+int32_t ConsoleHistory::findPrefix(uint16_t from, bool older, const char *text, size_t len)
+{
+    uint16_t key = len > 0 ? (uint8_t)text[0] | (len > 1 ? (uint8_t)text[1] << 8 : 0) : 0;
+    uint16_t mask = len > 1 ? 0xffff : (len > 0 ? 0x00ff : 0);
+
+    for (int32_t i = from; i >= 0 && i < num; i += older ? 1 : -1)
+    {
+        uint16_t s = slot(i);
+        if (prefix != NULL && (prefix[s] & mask) != key)
+            continue;
+        if (length(i) >= len && compare(index[s], 0, text, len))
+            return i;
+    }
+
+    return -1;
+}
@@ -0,0 +1,68 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLEHISTORY_H
+#define _CONSOLEHISTORY_H
+
+#include <Arduino.h>
+
+// Command history stored in a byte ring with a ring of entry offsets
+// Entry 0 is the most recent line. The oldest entries are evicted when
+// either the byte budget or the maximum number of entries is reached.
+//
+// A searchable history also keeps the first two characters of every entry
+// (the prefix index) and a list of the entries matching the last search
+// pattern, which is narrowed incrementally as the pattern grows.
+class ConsoleHistory
+{
+
+private:
+  char *buf;          // byte ring with the history lines, not zero terminated
+  uint16_t *index;    // ring of start offsets into buf, one per entry
+  uint16_t *prefix;   // first two characters of each entry, by index slot
+  uint16_t *matches;  // index slot and match position of each search match
+  uint16_t buf_size;  // size of the byte ring
+  uint16_t max_count; // size of the index ring
+  uint16_t first;     // index slot of the oldest entry
+  uint16_t num;       // number of entries
+  uint16_t head;      // write position in the byte ring
+  uint16_t used;      // bytes in use in the byte ring
+  uint16_t match_count;
+  const void *searcher; // console that made the last search, when the history is shared
+  bool owns_memory;
+
+  void init(char *buffer, size_t size, uint16_t *words, uint16_t entries, bool search);
+  uint16_t slot(uint16_t entry);
+  uint16_t entry(uint16_t slot);
+  char ring(uint16_t start, size_t pos);
+  bool compare(uint16_t start, size_t pos, const char *text, size_t len);
+  uint16_t find(uint16_t slot, size_t from, const char *pattern, size_t len);
+  void forget(uint16_t slot);
+  void evict();
+
+public:
+  static const uint16_t NO_MATCH = 0xffff;
+
+  ConsoleHistory(size_t size = 0, uint16_t entries = 16, bool search = true);
+  ConsoleHistory(char *buffer, size_t size, uint16_t *words, uint16_t entries, bool search = false);
+  virtual ~ConsoleHistory();
+
+  // Number of 16-bit index words needed for external storage
+  static size_t indexWords(uint16_t entries, bool search);
+
+  bool push(const char *line, size_t len);
+  void clear();
+
+  uint16_t count();
+  size_t length(uint16_t entry);
+  size_t offset(uint16_t entry);
+  char charAt(uint16_t entry, size_t pos);
+  size_t copy(uint16_t entry, char *dst, size_t max);
+
+  uint16_t search(const char *pattern, size_t len, bool narrow, const void *owner = NULL);
+  bool searchedBy(const void *owner);
+  uint16_t match(uint16_t num);
+  int32_t findPrefix(uint16_t from, bool older, const char *text, size_t len);
+};
+
+#endif
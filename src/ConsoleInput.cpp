@@ -6,6 +6,12 @@
 #define KEY_BUFFERED 0
 #define KEY_CTRL(n) (n - 64)
 
+#if CONSOLE_STATS
+#define COUNT_STAT(field) stats.field++
+#else
+#define COUNT_STAT(field)
+#endif
+
 // Definitions
 const int ConsoleInput::KEY_NONE;
 const int ConsoleInput::KEY_UNKNOWN;
@@ -14,6 +20,9 @@ const int ConsoleInput::KEY_BACKSPACE;
 const int ConsoleInput::KEY_LF;
 const int ConsoleInput::KEY_CR;
 const int ConsoleInput::KEY_FN;
+const uint32_t ConsoleInput::NO_DEADLINE;
+const uint8_t ConsoleInput::PASS_LENGTH;
+const uint8_t ConsoleInput::PASS_COBS;
 
 const int ConsoleInput::KEY_UP;
 const int ConsoleInput::KEY_DOWN;
@@ -35,62 +44,157 @@ const int ConsoleInput::MOD_ALT_GR;
 
 // ======== Constructors =======================
 
-ConsoleInput::ConsoleInput(Stream *serial, size_t size)
+ConsoleInput::ConsoleInput(Stream *serial, size_t size, size_t history_size, uint16_t history_entries)
+    : own_history(CONSOLE_HISTORY ? history_size : 0, history_entries), log_sink(this)
+{
+    // the line needs room for at least one character and the terminating zero
+    char *buffer = size >= 2 ? (char *)malloc(size) : NULL;
+    init(serial, buffer, buffer != NULL ? size : 0, history_size > 0);
+    flags.owns_buffer = true;
+}
+
+// Use storage provided by the caller, nothing is allocated on the heap
+ConsoleInput::ConsoleInput(Stream *serial, char *buffer, size_t size, char *history_buffer, size_t history_size,
+                           uint16_t *history_index, uint16_t history_entries)
+    : own_history(history_buffer, history_size, history_index, history_entries, true), log_sink(this)
+{
+    init(serial, size >= 2 ? buffer : NULL, size >= 2 ? size : 0, history_size > 0);
+    flags.owns_buffer = false;
+}
+
+ConsoleInput::~ConsoleInput()
+{
+    if (flags.owns_buffer)
+        free(input_buf);
+}
+
+void ConsoleInput::init(Stream *serial, char *buffer, size_t size, bool enable_history)
 {
     stream = serial;
+    input = serial;
+    ring = NULL;
+    frame.setTarget(serial);
+    history = &own_history;
 
     line_cb = NULL;
+    flags.own_completion = false;
+    setCommands(NULL, 0);
     flags.insert_mode = true;
     flags.debug_mode = false;
-    flags.auto_update = true;
-    flags.auto_edit = true;
-    flags.auto_move = true;
     flags.auto_clear = true;
     flags.auto_history = true;
+    flags.enable_history = CONSOLE_HISTORY && enable_history;
+    flags.in_batch = false;
+    flags.dirty = false;
+    flags.searching = false;
+    flags.prefix_recall = false;
+    flags.tab_pending = false;
+    flags.log_shown = false;
+    flags.log_open = false;
+    flags.reading_line = false;
+    flags.line_ready = false;
+    flags.pasting = false;
+    flags.paste_cr = false;
+    paste_match = 0;
+    setPassthrough(NULL, PASS_LENGTH);
+    notifier = NULL;
+    key_time = 0;
+    setEventQueue(NULL, 0);
+    resetStats();
     history_index = 0;
+    recall_prefix = 0;
+    search_match = 0;
     caret_pos = 0;
-    last_read = millis() - 0x0fff;
-    input_buf_size = size;
-
-    input_buf = (char *)malloc(size);
-    memset(input_buf, 0x00, size);
+    key_mods = 0;
+    escape_timeout = 250000;
+    last_redraw = millis();
+    redraw_interval = 0;
+    setPrompt("Prompt > ");
+    columns = 80;
+    rows = 24;
+    flags.dirty = true; // the prompt is drawn by the first readKey()
+
+    input_buf = buffer;
+    input_buf_size = buffer != NULL ? size : 0;
+    if (input_buf != NULL)
+        memset(input_buf, 0x00, input_buf_size);
+    line_len = 0;
+    gap_start = 0;
+    gap_end = input_buf_size;
     end_sequence(); // init esc_seq
 }
 
-ConsoleInput::~ConsoleInput()
-{
-    free(input_buf);
-}
-
 // ======== Escape Seqences =========================
 
-inline int16_t ConsoleInput::add_sequence()
+#define SEQ_NONE 0
+#define SEQ_ESC 1
+#define SEQ_CSI 2
+#define SEQ_SS3 3
+
+#define PASS_OFF 0
+#define PASS_LENGTH_HIGH 1
+#define PASS_LENGTH_LOW 2
+#define PASS_DATA 3
+#define PASS_GROUP 4 // COBS
+
+// Keys of "CSI n ~" sequences, indexed by n
+static const int16_t tilde_keys[] PROGMEM = {
+    0,                                                             // 0
+    ConsoleInput::KEY_HOME,      ConsoleInput::KEY_INSERT,         // 1, 2
+    ConsoleInput::KEY_DELETE,    ConsoleInput::KEY_END,            // 3, 4
+    ConsoleInput::KEY_PAGE_UP,   ConsoleInput::KEY_PAGE_DOWN,      // 5, 6
+    ConsoleInput::KEY_HOME,      ConsoleInput::KEY_END,            // 7, 8 (rxvt)
+#if CONSOLE_FUNCTION_KEYS
+    0,                           0,                                // 9, 10
+    ConsoleInput::KEY_FN + 1,    ConsoleInput::KEY_FN + 2,         // 11, 12
+    ConsoleInput::KEY_FN + 3,    ConsoleInput::KEY_FN + 4,         // 13, 14
+    ConsoleInput::KEY_FN + 5,    0,                                // 15, 16
+    ConsoleInput::KEY_FN + 6,    ConsoleInput::KEY_FN + 7,         // 17, 18
+    ConsoleInput::KEY_FN + 8,    ConsoleInput::KEY_FN + 9,         // 19, 20
+    ConsoleInput::KEY_FN + 10,   0,                                // 21, 22
+    ConsoleInput::KEY_FN + 11,   ConsoleInput::KEY_FN + 12,        // 23, 24
+#endif
+};
+
+// Keys of "CSI x" and "SS3 x" sequences, indexed by the final byte x - '@'
+static const int16_t final_keys[] PROGMEM = {
+    0,                                                   // @
+    ConsoleInput::KEY_UP,     ConsoleInput::KEY_DOWN,    // A, B
+    ConsoleInput::KEY_RIGHT,  ConsoleInput::KEY_LEFT,    // C, D
+    0,                        ConsoleInput::KEY_END,     // E, F
+    0,                        ConsoleInput::KEY_HOME,    // G, H
+#if CONSOLE_FUNCTION_KEYS
+    0, 0, 0, 0, 0, 0, 0,                                 // I - O
+    ConsoleInput::KEY_FN + 1, ConsoleInput::KEY_FN + 2,  // P, Q
+    ConsoleInput::KEY_FN + 3, ConsoleInput::KEY_FN + 4,  // R, S
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,                  // T - _
+#endif
+};
+
+inline void ConsoleInput::begin_sequence()
 {
-    char key;
-
-    // no input available
-    if (stream == NULL || !stream->available())
-    {
-        last_read = millis();
-        return 0;
-    }
-
-    // buffer position not available, read but don't buffer
-    if (esc_sequence[sizeof(esc_sequence) - 1] != 0)
-        return stream->read();
-
-    // it's zero terminated
-    size_t pos = strnlen(esc_sequence, sizeof(esc_sequence));
-    key = stream->read();
-    esc_sequence[pos] = key;
+    seq.state = SEQ_ESC;
+    seq.count = 0;
+    seq.extended = false;
+    seq.param[0] = 0;
+    seq.param[1] = 0;
+    seq.length = 0;
+    add_sequence(0x1b);
+}
 
-    return key;
+inline void ConsoleInput::add_sequence(uint8_t c)
+{
+    // keep the buffer zero terminated, extra bytes are not stored
+    if (seq.length < sizeof(esc_sequence) - 1)
+        esc_sequence[seq.length++] = c;
 }
 
 inline void ConsoleInput::end_sequence()
 {
     //  Clear escape sequence buffer
     memset(esc_sequence, 0, sizeof(esc_sequence));
+    seq.state = SEQ_NONE;
+    seq.length = 0;
 }
 
 inline void ConsoleInput::print_sequence()
@@ -98,104 +202,338 @@ inline void ConsoleInput::print_sequence()
     if (stream == NULL)
         return;
 
-    stream->println();
-    stream->printf_P(PSTR("\\e%s => "), esc_sequence + 1);
-    for (int i = 1; i < (int)sizeof(esc_sequence); i++)
+    frame.println();
+    frame.printf_P(PSTR("\\e%s => "), esc_sequence + 1);
+    for (int i = 1; i < seq.length; i++)
+        frame.printf_P(PSTR("0x%2X %c "), esc_sequence[i], esc_sequence[i]);
+
+    frame.println();
+    shown.full = true;
+    refresh();
+}
+
+// Feed one byte of an escape sequence into the state machine
+int16_t ConsoleInput::decode_sequence(uint8_t c)
+{
+    add_sequence(c);
+
+    switch (seq.state)
     {
-        if (esc_sequence[i] == 0)
+    case SEQ_ESC:
+        switch (c)
         {
-            stream->println();
-            if (flags.auto_update)
-                update();
-            return;
+        case 0x1b: // ESC ESC
+            end_sequence();
+            key_mods = 0;
+            if (CONSOLE_HISTORY && flags.searching)
+                search_key(KEY_ESC);
+            return KEY_ESC;
+
+        case '[': // CSI mode
+            seq.state = SEQ_CSI;
+            return KEY_BUFFERED;
+
+        case 'O': // SS3 mode
+            seq.state = SEQ_SS3;
+            return KEY_BUFFERED;
+        }
+
+        if (c >= 0x20 && c < 0x7f)
+        { // Alt + printable character
+            end_sequence();
+            key_mods = MOD_ALT;
+            return c | MOD_ALT;
+        }
+        break;
+
+    case SEQ_CSI:
+        if (c >= '0' && c <= '9')
+        { // parameter digits
+            uint16_t *param = &seq.param[seq.count];
+            if (*param < 1000)
+                *param = *param * 10 + c - '0';
+            return KEY_BUFFERED;
+        }
+        if (c == ';')
+        { // parameter separator, extra parameters are ignored
+            if (seq.count < sizeof(seq.param) / sizeof(seq.param[0]) - 1)
+                seq.count++;
+            return KEY_BUFFERED;
         }
-        stream->printf_P(PSTR("0x%2X %c "), esc_sequence[i], esc_sequence[i]);
+        if (c >= 0x20 && c <= 0x3F)
+        { // private parameter and intermediate bytes
+            seq.extended = true;
+            return KEY_BUFFERED;
+        }
+        if (c >= 0x40 && c <= 0x7E)
+            return finish_sequence(c);
+        break;
+
+    case SEQ_SS3:
+        if (c >= 0x40 && c <= 0x7E)
+            return finish_sequence(c);
+        break;
     }
 
-    stream->println();
-    if (flags.auto_update)
-        update();
+    return unknown_sequence();
+}
+
+// Map a complete sequence to a key code through the lookup tables
+int16_t ConsoleInput::finish_sequence(uint8_t c)
+{
+    if (seq.extended)
+        return unknown_sequence();
+
+    if (seq.state == SEQ_CSI && c == 'R')
+    { // cursor position returned from query "\e[6n"
+        end_sequence();
+        key_mods = 0;
+        return KEY_NONE;
+    }
+
+    uint16_t number = seq.param[0];
+    if (CONSOLE_PASTE && c == '~' && seq.count == 0 && (number == 200 || number == 201))
+    { // start of a bracketed paste, an end marker outside a paste is ignored
+        end_sequence();
+        key_mods = 0;
+        if (number == 200)
+        {
+            if (CONSOLE_HISTORY && flags.searching)
+                end_search(true);
+            flags.pasting = true;
+            flags.paste_cr = false;
+            paste_match = 0;
+        }
+        return KEY_BUFFERED;
+    }
+
+    int16_t key = 0;
+    if (c == '~')
+    {
+        if (seq.param[0] < sizeof(tilde_keys) / sizeof(tilde_keys[0]))
+            key = pgm_read_word(tilde_keys + seq.param[0]);
+    }
+    else if (c >= '@' && c < '@' + sizeof(final_keys) / sizeof(final_keys[0]))
+    {
+        key = pgm_read_word(final_keys + c - '@');
+    }
+
+    if (key == 0)
+        return unknown_sequence();
+
+    // xterm modifier parameter, e.g. "\e[1;5C" = Ctrl + Right
+    uint16_t mod = seq.count > 0 && seq.param[1] > 1 ? seq.param[1] - 1 : 0;
+    key_mods = (mod & 1 ? MOD_SHIFT : 0) | (mod & 2 ? MOD_ALT : 0) | (mod & 4 ? MOD_CTRL : 0) |
+               (mod & 8 ? MOD_CMND : 0);
+
+    end_sequence();
+    if (CONSOLE_HISTORY && flags.searching && search_key(key))
+        return key;
+    key = special_key(key);
+
+    // function keys are negative, their modifiers are only available from getModifiers()
+    return key >= 0 ? key | key_mods : key;
+}
+
+int16_t ConsoleInput::unknown_sequence()
+{
+    COUNT_STAT(sequences_unknown);
+    if (CONSOLE_DEBUG && flags.debug_mode)
+        print_sequence();
+    end_sequence();
+    key_mods = 0;
+    return KEY_UNKNOWN;
+}
+
+// Modifiers of the last special key returned by readKey()
+int16_t ConsoleInput::getModifiers()
+{
+    return key_mods;
+}
+
+// Apply the line editing action of a special key
+int16_t ConsoleInput::special_key(int16_t key)
+{
+    switch (key)
+    {
+    case KEY_UP:
+        step_history(true);
+        break;
+
+    case KEY_DOWN:
+        step_history(false);
+        break;
+
+    case KEY_RIGHT:
+        if (CONSOLE_AUTO_MOVE)
+            setCaret(caret_pos + 1);
+        break;
+
+    case KEY_LEFT:
+        if (CONSOLE_AUTO_MOVE)
+            setCaret(caret_pos - 1);
+        break;
+
+    case KEY_HOME:
+        if (input_buf != NULL && CONSOLE_AUTO_MOVE)
+            setCaret(0);
+        break;
+
+    case KEY_END:
+        if (input_buf != NULL && CONSOLE_AUTO_MOVE)
+            setCaret(line_len);
+        break;
+
+    case KEY_DELETE:
+        if (CONSOLE_AUTO_EDIT)
+            do_delete();
+        break;
+
+    case KEY_INSERT:
+        flags.insert_mode = !flags.insert_mode;
+        break;
+    }
+
+    return key;
 }
 
 // ======== Default Print Methods =========================
 int ConsoleInput::available(void)
 {
-    if (stream == NULL)
+    if (input == NULL)
         return 0;
     else
-        return stream->available();
+        return input->available();
 }
 
 int ConsoleInput::peek(void)
 {
-    if (stream == NULL)
+    if (input == NULL)
         return -1;
     else
-        return stream->peek();
+        return input->peek();
 }
 
 int ConsoleInput::read(void)
 {
-    last_read = millis();
-    if (stream == NULL)
+    if (input == NULL)
+        return 0;
+    else
+        return input->read();
+}
+
+size_t ConsoleInput::readBytes(char *buffer, size_t length)
+{
+    if (input == NULL)
         return 0;
     else
-        return stream->read();
+        return input->readBytes(buffer, length);
 }
 
 void ConsoleInput::flush(void)
 {
+    frame.flush();
     if (stream != NULL)
         stream->flush();
 }
 
+// Application output goes after any pending editor output
 size_t ConsoleInput::write(uint8_t c)
 {
+    // application output moves the cursor, the next update redraws everything
+    shown.full = true;
+    frame.flush();
+
     if (stream == NULL)
         return 0;
     else
         return stream->write(c);
 }
 
+size_t ConsoleInput::write(const uint8_t *buffer, size_t size)
+{
+    shown.full = true;
+    frame.flush();
+
+    if (stream == NULL)
+        return 0;
+    else
+        return stream->write(buffer, size);
+}
+
 // ======== Editing Character Buffer =========================
+// The line is kept in a gap buffer: input_buf[0, gap_start) holds the text
+// before the gap and input_buf[gap_end, input_buf_size) the text after it.
+// The gap follows the caret lazily, so typing and deleting are O(1).
+
+// Move the gap to a position on the line
+void ConsoleInput::move_gap(size_t pos)
+{
+    if (pos < gap_start)
+    {
+        size_t count = gap_start - pos;
+        gap_end -= count;
+        memmove(input_buf + gap_end, input_buf + pos, count);
+    }
+    else if (pos > gap_start)
+    {
+        size_t count = pos - gap_start;
+        memmove(input_buf + gap_start, input_buf + gap_end, count);
+        gap_end += count;
+    }
+    gap_start = pos;
+}
+
+// Character at a position of the line, 0 past the end
+inline char ConsoleInput::char_at(size_t pos)
+{
+    if (pos >= line_len)
+        return 0;
+    return input_buf[pos < gap_start ? pos : pos + gap_end - gap_start];
+}
+
+// Write the characters of the line between from and to
+void ConsoleInput::write_line(size_t from, size_t to)
+{
+    if (from < gap_start)
+    {
+        size_t end = to < gap_start ? to : gap_start;
+        frame.write((const uint8_t *)input_buf + from, end - from);
+        from = end;
+    }
+    if (from < to)
+        frame.write((const uint8_t *)input_buf + from + gap_end - gap_start, to - from);
+}
+
 void ConsoleInput::do_backspace()
 {
-    if (input_buf == NULL)
+    if (input_buf == NULL || caret_pos == 0)
         return;
 
     history_index = 0;
 
-    // history scrolling can make it go out-of-bounds
-    size_t len = strnlen(input_buf, input_buf_size);
-    if (caret_pos > len)
-        caret_pos = len;
-
-    if (caret_pos <= 0)
-        return;
+    move_gap(caret_pos);
+    gap_start--;
     caret_pos--;
+    line_len--;
+    mark_dirty(caret_pos);
 
-    char *src = input_buf + caret_pos + 1;
-    char *dst = input_buf + caret_pos;
-    memmove(dst, src, len - caret_pos);
-
-    if (flags.auto_update)
-        update();
+    refresh();
 }
 
 void ConsoleInput::do_delete()
 {
-    if (input_buf == NULL)
+    if (input_buf == NULL || caret_pos >= line_len)
         return;
 
     history_index = 0;
 
-    size_t len = strnlen(input_buf, input_buf_size);
-    char *dst = input_buf + caret_pos;
-    char *src = input_buf + caret_pos + 1;
-    memmove(dst, src, len - caret_pos);
+    move_gap(caret_pos);
+    gap_end++;
+    line_len--;
+    mark_dirty(caret_pos);
 
-    if (flags.auto_update)
-        update();
+    refresh();
 }
 
 bool ConsoleInput::insertCharacter(char ch, size_t pos)
@@ -205,40 +543,26 @@ bool ConsoleInput::insertCharacter(char ch, size_t pos)
 
     history_index = 0;
 
-    size_t len = strnlen(input_buf, input_buf_size);
-
-    // history invoke can make the index go out-of-bounds
-    if (pos > len)
-        pos = len;
-
-    if (pos == len && pos < input_buf_size - 2)
-    {
-        // expand 1 character to the right
-        if (input_buf[pos + 1] != 0)
-        {
-            // shift right needed
-            char *dst = input_buf + len + 1;
-            char *src = input_buf + len;
-            memmove(dst, src, input_buf_size - len - 1);
-        }
-        else
-        {
-            // we still have room
-        }
-    }
+    if (pos > line_len)
+        pos = line_len;
 
-    // Insert character if we have room
-    if (pos < input_buf_size - 2)
+    // Overwrite character
+    if (!flags.insert_mode && pos < line_len)
     {
-        if (pos + 1 >= len)
-            input_buf[pos + 1] = 0;
-        input_buf[pos] = ch;
-        pos++;
+        input_buf[pos < gap_start ? pos : pos + gap_end - gap_start] = ch;
+        mark_dirty(pos);
         return true;
     }
 
-    // Buffer is full
-    return false;
+    // Buffer is full, keep room for the terminating zero
+    if (line_len + 1 >= input_buf_size)
+        return false;
+
+    move_gap(pos);
+    input_buf[gap_start++] = ch;
+    line_len++;
+    mark_dirty(pos);
+    return true;
 }
 
 bool ConsoleInput::insertCharacter(char ch)
@@ -246,14 +570,42 @@ bool ConsoleInput::insertCharacter(char ch)
     if (insertCharacter(ch, caret_pos))
     {
         caret_pos++;
-        if (flags.auto_update)
-            update();
+        refresh();
         return true;
     }
 
     return false;
 }
 
+// Insert text at the caret, the gap is moved once and the line is redrawn once
+// Text that does not fit in the buffer is dropped
+void ConsoleInput::insert_text(const char *text, size_t len)
+{
+    if (input_buf == NULL || len == 0)
+        return;
+
+    if (!flags.insert_mode)
+    {
+        for (size_t i = 0; i < len && insertCharacter(text[i], caret_pos); i++)
+            caret_pos++;
+        refresh();
+        return;
+    }
+
+    size_t room = input_buf_size - 1 - line_len;
+    if (len > room)
+        len = room;
+
+    history_index = 0;
+    move_gap(caret_pos);
+    memcpy(input_buf + gap_start, text, len);
+    gap_start += len;
+    line_len += len;
+    mark_dirty(caret_pos);
+    caret_pos += len;
+    refresh();
+}
+
 // ======== Caret Movement =========================
 
 // Get the position of the caret on the input buffer
@@ -269,11 +621,10 @@ void ConsoleInput::setCaret(int16_t index)
         return;
 
     history_index = 0;
-    size_t len = strnlen(input_buf, input_buf_size);
 
-    if (index > (int16_t)len)
+    if (index > (int16_t)line_len)
     {
-        caret_pos = len;
+        caret_pos = line_len;
     }
     else if (index < 0)
     {
@@ -284,430 +635,990 @@ void ConsoleInput::setCaret(int16_t index)
         caret_pos = index;
     }
 
-    if (flags.auto_update)
-        update();
+    refresh();
 }
 
 // ======== History =========================
 
-size_t ConsoleInput::debugHistorycount()
+// Replace the line with a history entry, 0 is the line being edited
+void ConsoleInput::recall_history(size_t index)
 {
-    if (input_buf == NULL)
-        return 0;
+    if (!CONSOLE_HISTORY || input_buf == NULL || index > history->count())
+        return;
 
-    size_t count = 0;
-    for (size_t i = 1; i < input_buf_size; i++)
+    if (index == 0)
     {
-        if (input_buf[i] == 0 && input_buf[i - 1] != 0)
-            count++;
+        clearLine();
+        return;
     }
-    return count;
+
+    COUNT_STAT(history_recalls);
+    line_len = history->copy(index - 1, input_buf, input_buf_size - 1);
+    gap_start = line_len;
+    gap_end = input_buf_size;
+    caret_pos = line_len;
+    history_index = index;
+    mark_dirty(0);
+    refresh();
 }
 
-size_t ConsoleInput::debugHistoryIndex(size_t num)
+// Print a history entry
+void ConsoleInput::write_history(uint16_t entry)
 {
-    size_t pos = 0;
-    while (num > 0 && pos < input_buf_size - 2)
+    char buf[16];
+    size_t len = history->length(entry);
+    for (size_t pos = 0; pos < len; pos += sizeof(buf))
     {
-        if (input_buf[pos] == 0)
-        {
-            num--;
-            // skip extra \0s
-            while (input_buf[pos] == 0)
-            {
-                pos++;
-            }
-        }
-        else
-        {
-            pos++;
-        }
+        size_t count = len - pos < sizeof(buf) ? len - pos : sizeof(buf);
+        for (size_t c = 0; c < count; c++)
+            buf[c] = history->charAt(entry, pos + c);
+        frame.write((const uint8_t *)buf, count);
     }
-
-    return pos;
 }
 
-void ConsoleInput::debugShowHistory()
+// Recall the previous (older) or next history entry
+// With prefix recall only entries starting with the text before the caret are recalled
+void ConsoleInput::step_history(bool older)
 {
-    if (stream == NULL)
+    if (!CONSOLE_HISTORY || input_buf == NULL || !flags.enable_history)
         return;
 
-    size_t num = debugHistorycount();
-    stream->println();
-    for (size_t i = 0; i <= num; i++)
+    if (!flags.prefix_recall)
     {
-        stream->print("[");
-        stream->print(i);
-        stream->print("] ");
-        size_t pos = debugHistoryIndex(i);
-        if (pos < input_buf_size)
-            stream->println((char *)(input_buf + pos));
-    }
-}
-
-// ======== Input Line =========================
-
-// Print current input buffer
-void ConsoleInput::update()
-{
-    if (stream == NULL)
+        if (older && history_index < history->count())
+            recall_history(history_index + 1);
+        else if (!older && history_index > 0)
+            recall_history(history_index - 1);
         return;
+    }
 
-    stream->print(F(TERM_CLEAR_LINE)); // Move all the way left + Clear the line
-    stream->print(F("Prompt > "));
+    if (history_index == 0)
+    {
+        if (!older)
+            return;
+        recall_prefix = caret_pos;
+    }
 
-    if (input_buf == NULL)
-        return;
+    // recalled entries all start with the prefix, so it is still on the line
+    int32_t entry = -1;
+    COUNT_STAT(history_searches);
+    if (older)
+        entry = history->findPrefix(history_index, true, getLine(), recall_prefix);
+    else if (history_index >= 2)
+        entry = history->findPrefix(history_index - 2, false, getLine(), recall_prefix);
 
-    if (flags.debug_mode)
+    if (entry >= 0)
     {
-
-        for (uint i = 0; i < input_buf_size; i++)
-        {
-            if (input_buf[i] == 0)
-            {
-                stream->print("|");
-            }
-            else
-            {
-                stream->print((char)input_buf[i]);
-            }
-        }
-        stream->print(history_index);
-        stream->print("/");
-        /*stream->print(debugHistorycount());*/
+        recall_history(entry + 1);
     }
-    else
-    {
-
-        stream->print(input_buf);
+    else if (!older)
+    { // back to the typed prefix
+        if (recall_prefix > line_len)
+            recall_prefix = line_len;
+        move_gap(recall_prefix);
+        gap_end = input_buf_size;
+        line_len = recall_prefix;
+        caret_pos = recall_prefix;
+        history_index = 0;
+        mark_dirty(recall_prefix);
+        refresh();
     }
+}
 
-    stream->print("\e[1000D"); // Move all the way left again
-
-    /*if(caret_pos > 0)*/ {
-        stream->print("\e[");
-        stream->print(caret_pos + 9); // Move caret to index
-        stream->print("C");
-    }
+// Only recall history entries that start with the text before the caret
+void ConsoleInput::setPrefixRecall(bool enable)
+{
+    flags.prefix_recall = enable;
 }
 
-void ConsoleInput::setLineCallback(void (*callback)(const char *))
+// Use another history, e.g. one shared by several consoles, NULL returns to the own history
+// Entry numbers of a shared history shift when another console adds a line
+void ConsoleInput::setHistory(ConsoleHistory *shared)
 {
-    if (flags.auto_update && ((uint16_t)millis() - last_read) >= 0x0fff)
-    {
-        update();
-    }
+    if (!CONSOLE_HISTORY)
+        return;
 
-    line_cb = callback;
+    if (flags.searching)
+        end_search(false);
+
+    history = shared != NULL ? shared : &own_history;
+    if (shared != NULL)
+        flags.enable_history = true;
+    history_index = 0;
 }
 
-const char *ConsoleInput::getLine()
+// ======== Reverse Search =========================
+
+// Search the history for the pattern on the line, narrowing the previous matches if set
+// A shared history keeps the matches of one console, another console searches again
+void ConsoleInput::search_history(bool narrow)
 {
-    return input_buf;
+    COUNT_STAT(history_searches);
+    history->search(getLine(), line_len, narrow && history->searchedBy(this), this);
+    search_match = 0;
 }
 
-void ConsoleInput::pushLine()
+// Entry number of a search match, the search is repeated when another console searched since
+uint16_t ConsoleInput::search_entry(uint16_t num)
 {
+    if (!history->searchedBy(this))
+        history->search(getLine(), line_len, false, this);
+    return history->match(num);
 }
 
-void ConsoleInput::clearLine()
+// Start an incremental reverse search, the current line is the search pattern
+void ConsoleInput::begin_search()
 {
-    if (input_buf == NULL)
+    if (!CONSOLE_HISTORY || input_buf == NULL || !flags.enable_history)
         return;
 
-    size_t len = strnlen(input_buf, input_buf_size);
-    memset(input_buf, 0, len);
-    setCaret(0);
+    flags.searching = true;
+    search_history(false);
+    caret_pos = line_len;
+    shown.full = true;
+    refresh();
 }
 
-int16_t ConsoleInput::getChar(uint8_t index)
+// Leave search mode, optionally replacing the line with the current match
+void ConsoleInput::end_search(bool accept)
 {
-    int16_t key;
+    uint16_t entry = search_entry(search_match);
 
-    // flush buffer if sequence is not closed in timely fashion
-    if (esc_sequence[index] != 0x00 && ((uint16_t)millis() - last_read) > 250)
-    {
-        key = esc_sequence[index];
-        memmove(esc_sequence, esc_sequence + 1, sizeof(esc_sequence) - 1);
-        esc_sequence[sizeof(esc_sequence) - 1] = 0;
-        return key; // flush one char at the time
-    }
+    flags.searching = false;
+    shown.full = true;
 
-    last_read = millis();
+    // the match was not recalled by its prefix, stepping from it recalls any entry
+    recall_prefix = 0;
+    if (accept && entry != ConsoleHistory::NO_MATCH)
+        recall_history(entry + 1);
+    else
+        refresh();
+}
 
-    // no input available
-    if (stream == NULL || !stream->available())
+// Handle a key in search mode, returns false if the key still needs to be processed
+bool ConsoleInput::search_key(int16_t key)
+{
+    switch (key)
     {
-        return 0;
-    }
+    case KEY_CTRL('R'): // next older match
+        if (search_entry(search_match + 1) != ConsoleHistory::NO_MATCH)
+            search_match++;
+        refresh();
+        return true;
 
-    // buffer position not available
-    if (index >= sizeof(esc_sequence))
-        return stream->read();
+    case KEY_BACKSPACE: // a shorter pattern can match more entries, search again
+        if (line_len > 0)
+        {
+            move_gap(line_len);
+            gap_start--;
+            line_len--;
+            caret_pos = line_len;
+            search_history(false);
+        }
+        refresh();
+        return true;
 
-    // buffer position available and used
-    if (esc_sequence[index] != 0x00)
-        return esc_sequence[index];
+    case KEY_CTRL('C'):
+    case KEY_CTRL('G'):
+    case KEY_ESC:
+        end_search(false);
+        return true;
+    }
 
-    // buffer position available but not used
-    key = stream->read();
-    esc_sequence[index] = key;
+    if (key >= 0x20 && key < 0xff)
+    { // a longer pattern only narrows the matches
+        if (insertCharacter(key, line_len))
+        {
+            caret_pos = line_len;
+            search_history(true);
+        }
+        refresh();
+        return true;
+    }
 
-    return key;
+    end_search(true);
+    return false;
 }
 
-// Read a key from the terminal or -1 if no key pressed
-int16_t ConsoleInput::readKey()
+// Show the search pattern and the current match
+void ConsoleInput::redraw_search()
 {
-    // forced update during constructor, setting last_read to 0x0fff
-    if (flags.auto_update && ((uint16_t)millis() - last_read) >= 0x0fff)
-    {
-        update();
-    }
-
-    int16_t key;
+    frame.print(F(TERM_CLEAR_LINE));
+    frame.print(F("(reverse-i-search)`"));
+    write_line(0, line_len);
+    frame.print(F("': "));
+
+    uint16_t entry = search_entry(search_match);
+    if (entry != ConsoleHistory::NO_MATCH)
+        write_history(entry);
+}
 
-    key = getChar(0);
-    if (key <= 0)
-        return 0;
+// Add the current line to the history
+void ConsoleInput::pushLine()
+{
+    if (!CONSOLE_HISTORY || input_buf == NULL || !flags.enable_history)
+        return;
 
-    if (key == 0x1b)
-    { /* escape sequence */
+    COUNT_STAT(history_pushes);
+    history->push(getLine(), line_len);
+    history_index = 0;
+}
 
-        key = getChar(1);
-        if (key <= 0)
-            return 0;
+size_t ConsoleInput::debugHistorycount()
+{
+    return history->count();
+}
 
-        switch (key)
-        {
-        case 0x1b: // ESC
-            end_sequence();
-            return KEY_ESC;
+// Position of a history entry in the history buffer
+size_t ConsoleInput::debugHistoryIndex(size_t num)
+{
+    return history->offset(num);
+}
 
-        case '[':
-        { // CSI mode
-            char appended_key = add_sequence();
-            if (appended_key <= 0)
-                return 0;
+void ConsoleInput::debugShowHistory()
+{
+    if (!CONSOLE_DEBUG || stream == NULL)
+        return;
 
-            switch (appended_key)
-            {
+    size_t num = debugHistorycount();
+    frame.println();
+    for (size_t i = 0; i <= num; i++)
+    {
+        frame.print("[");
+        frame.print(i);
+        frame.print("] ");
+        if (i == 0)
+        {
+            frame.println(getLine());
+            continue;
+        }
 
-            case 0x30 ... 0x3F:      // parameter bytes
-            case 0x20 ... 0x2F:      // intermediate bytes
-                return KEY_BUFFERED; // added to esc_seq, more data in flight
-
-            case 'A':
-                // size_t count = debugHistorycount();
-                //     if(history_index < count) {
-                //         history_index++;
-                //         debugGetHistoryLine(history_index);
-                //     }
-                end_sequence();
-                return KEY_UP;
-
-            case 'B':
-                // if(history_index > 0) {
-                //         history_index--;
-                //         debugGetHistoryLine(history_index);
-                //     }
-                end_sequence();
-                return KEY_DOWN;
-
-            case 'C':
-                if (flags.auto_move)
-                    setCaret(caret_pos + 1);
-                end_sequence();
-                return KEY_RIGHT;
-
-            case 'D':
-                if (flags.auto_move)
-                    setCaret(caret_pos - 1);
-                end_sequence();
-                return KEY_LEFT;
-
-            case 'R':
-                // cursor_position returned from query "\e[6n"
-                // update_cursor_position();
-                end_sequence();
-                return KEY_NONE;
-
-            case 'E' ... 'Q':  // End Characters, esc_sequence is complete
-            case 'S' ... 0x7D: // End Characters, esc_sequence is complete
-            case '@':
-                print_sequence();
-                end_sequence();
-                return KEY_UNKNOWN;
-
-            case '~':
-            {
-                char *seq = esc_sequence + 2;
-                uint8_t size = sizeof(esc_sequence) - 2;
-                if (!strncmp_P(seq, PSTR("1~"), size))
-                {
-                    if (input_buf != NULL && flags.auto_move)
-                    {
-                        setCaret(0);
-                    }
-                    end_sequence();
-                    return KEY_HOME;
-                }
-                else if (!strncmp_P(seq, PSTR("2~"), size))
-                {
-                    end_sequence();
-                    return KEY_INSERT;
-                }
-                else if (!strncmp_P(seq, PSTR("3~"), size))
-                {
-                    do_delete();
-                    end_sequence();
-                    return KEY_DELETE;
-                }
-                else if (!strncmp_P(seq, PSTR("4~"), size))
-                {
-                    if (input_buf != NULL && flags.auto_move)
-                    {
-                        setCaret(strnlen(input_buf, input_buf_size));
-                    }
-                    end_sequence();
-                    return KEY_END;
-                }
-                else if (!strncmp_P(seq, PSTR("5~"), size))
-                {
-                    end_sequence();
-                    return KEY_PAGE_UP;
-                }
-                else if (!strncmp_P(seq, PSTR("6~"), size))
-                {
-                    end_sequence();
-                    return KEY_PAGE_DOWN;
-                }
-                else if (!strncmp_P(seq, PSTR("11~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 1;
-                }
-                else if (!strncmp_P(seq, PSTR("12~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 2;
-                }
-                else if (!strncmp_P(seq, PSTR("13~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 3;
-                }
-                else if (!strncmp_P(seq, PSTR("14~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 4;
-                }
-                else if (!strncmp_P(seq, PSTR("15~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 5;
-                }
-                else if (!strncmp_P(seq, PSTR("17~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 6;
-                }
-                else if (!strncmp_P(seq, PSTR("18~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 7;
-                }
-                else if (!strncmp_P(seq, PSTR("19~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 8;
-                }
-                else if (!strncmp_P(seq, PSTR("20~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 9;
-                }
-                else if (!strncmp_P(seq, PSTR("21~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 10;
-                }
-                else if (!strncmp_P(seq, PSTR("23~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 11;
-                }
-                else if (!strncmp_P(seq, PSTR("24~"), size))
-                {
-                    end_sequence();
-                    return KEY_FN + 12;
-                }
-                print_sequence();
-                end_sequence();
-            }
+        write_history(i - 1);
+        frame.println();
+    }
+    shown.full = true;
+    send_frame();
+}
 
-                // end_sequence();
-                return KEY_BUFFERED; // added to esc_seq, more data in flight
+// ======== Completion =========================
+// The vocabulary is a sorted table of words, which can be stored in PROGMEM.
+// The words starting with a prefix form one range of the table, found with
+// two binary searches, and the common prefix of that range is the common
+// prefix of its first and last word. The table works as a flattened trie,
+// without any RAM or heap use.
+
+// Set the words for TAB completion, sorted in strcmp order
+// Words can contain spaces to complete sub-commands, like "wifi scan"
+// The words take precedence over the command table, NULL completes the command names again
+void ConsoleInput::setCompletion(const char *const *words, size_t count)
+{
+    flags.own_completion = words != NULL;
+    if (words == NULL)
+    { // back to the command names
+        setCommands(commands, command_count);
+        return;
+    }
 
-            default:
-                // should not happen
-                if (stream != NULL)
-                    stream->println(F("WARNING !!!"));
-                return KEY_BUFFERED; // added to esc_seq
-            }
+    completion = (const uint8_t *)words;
+    completion_count = count;
+    completion_stride = sizeof(const char *);
+}
+
+inline const char *ConsoleInput::completion_word(size_t index)
+{
+    return (const char *)pgm_read_ptr(completion + index * completion_stride);
+}
+
+// First word that is not smaller than the prefix, or that does not start with it when past is set
+size_t ConsoleInput::completion_bound(const char *prefix, size_t len, bool past)
+{
+    size_t lo = 0;
+    size_t hi = completion_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp_P(prefix, completion_word(mid), len);
+        if (cmp > 0 || (past && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Complete the text before the caret, or list the candidates on a double TAB
+void ConsoleInput::complete(bool list)
+{
+    if (input_buf == NULL || completion_count == 0)
+        return;
+
+    // the text before the caret is contiguous once the gap is at the caret
+    move_gap(caret_pos);
+    const char *prefix = input_buf;
+    size_t len = caret_pos;
+
+    size_t first = completion_bound(prefix, len, false);
+    size_t last = completion_bound(prefix, len, true);
+    if (first >= last)
+        return;
+
+    // common prefix of all candidates
+    const char *a = completion_word(first);
+    const char *b = completion_word(last - 1);
+    size_t common = len;
+    char c;
+    while ((c = pgm_read_byte(a + common)) != 0 && c == (char)pgm_read_byte(b + common))
+        common++;
+
+    if (common > len || last - first == 1)
+    {
+        bool batch = flags.in_batch;
+        flags.in_batch = true;
+        for (size_t i = len; i < common; i++)
+            insertCharacter(pgm_read_byte(a + i));
+        if (last - first == 1 && char_at(caret_pos) != ' ')
+            insertCharacter(' ');
+        flags.in_batch = batch;
+        refresh();
+        return;
+    }
+
+    if (!list || stream == NULL)
+    {
+        flags.tab_pending = true;
+        return;
+    }
+
+    // list the candidates from the start of the word being completed
+    size_t word = len;
+    while (word > 0 && prefix[word - 1] != ' ')
+        word--;
+
+    size_t column = 0;
+    frame.println();
+    for (size_t i = first; i < last; i++)
+    {
+        const char *candidate = completion_word(i) + word;
+        size_t width = strlen_P(candidate) + 2;
+        if (column > 0 && column + width > columns)
+        {
+            frame.println();
+            column = 0;
+        }
+        for (size_t pos = 0; (c = pgm_read_byte(candidate + pos)) != 0; pos++)
+            frame.print(c);
+        frame.print(F("  "));
+        column += width;
+    }
+    frame.println();
+    shown.full = true;
+    refresh();
+}
+
+// ======== Commands =========================
+
+// Set the command table, sorted by name in strcmp order, which can be stored in PROGMEM
+// Lines starting with a known command are dispatched to its handler, other lines
+// go to the line callback. The command names are also used for TAB completion.
+void ConsoleInput::setCommands(const ConsoleCommand *commands, size_t count)
+{
+    this->commands = commands;
+    command_count = commands != NULL ? count : 0;
+
+    // words set with setCompletion() take precedence, whatever the order of the calls
+    if (flags.own_completion)
+        return;
+    completion = (const uint8_t *)commands;
+    completion_count = command_count;
+    completion_stride = sizeof(ConsoleCommand);
+}
+
+// Binary search for a command name, returns the table index or -1
+int32_t ConsoleInput::find_command(const char *name, size_t len)
+{
+    size_t lo = 0;
+    size_t hi = command_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *entry = (const char *)pgm_read_ptr(&commands[mid].name);
+        int cmp = strncmp_P(name, entry, len);
+        if (cmp == 0 && pgm_read_byte(entry + len) != 0)
+            cmp = -1; // the entry is longer
+        if (cmp == 0)
+            return mid;
+        if (cmp > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+// Run the handler of the command on the line, returns false if there is none
+bool ConsoleInput::dispatch()
+{
+    if (command_count == 0)
+        return false;
+
+    char *line = (char *)getLine();
+    size_t start = 0;
+    while (line[start] == ' ' || line[start] == '\t')
+        start++;
+    size_t end = start;
+    while (line[end] != 0 && line[end] != ' ' && line[end] != '\t')
+        end++;
+    if (end == start)
+        return false;
+
+    int32_t index = find_command(line + start, end - start);
+    if (index < 0)
+        return false;
+
+    char *argv[CONSOLE_MAX_ARGS];
+    int argc = tokenize(line, argv, CONSOLE_MAX_ARGS);
+
+    void (*handler)(int, char *[]);
+    handler = (void (*)(int, char *[]))pgm_read_ptr(&commands[index].handler);
+    if (handler != NULL)
+        handler(argc, argv);
+    return true;
+}
+
+// Split a line into arguments in place, without using the heap
+// Arguments are separated by spaces or tabs. Text between "double" or 'single'
+// quotes is one argument and a backslash escapes the next character, except
+// between single quotes. Returns the number of arguments, at most max_args.
+int ConsoleInput::tokenize(char *line, char *argv[], int max_args)
+{
+    int argc = 0;
+    char *src = line;
+    char *dst = line; // never ahead of src, quotes and escapes make the text shorter
+
+    while (argc < max_args)
+    {
+        while (*src == ' ' || *src == '\t')
+            src++;
+        if (*src == 0)
             break;
 
-        } // CSI mode
+        argv[argc++] = dst;
+        char quote = 0;
+        while (*src != 0)
+        {
+            char c = *src;
+            if (quote == 0 && (c == ' ' || c == '\t'))
+                break;
+            src++;
+
+            if (c == quote)
+            { // closing quote
+                quote = 0;
+                continue;
+            }
+            if (quote == 0 && (c == '"' || c == '\''))
+            { // opening quote
+                quote = c;
+                continue;
+            }
+            if (c == '\\' && quote != '\'' && *src != 0)
+                c = *src++;
 
-        case 'O':
-        { // CSO mode
+            *dst++ = c;
+        }
 
-            key = getChar(2);
-            if (key < 0)
-                return 0;
-            print_sequence();
+        if (*src != 0)
+            src++; // skip the separator
+        *dst++ = 0;
+    }
+
+    return argc;
+}
+
+// ======== Input Line =========================
+
+// Redraw after an edit, or postpone the redraw while a batch is being processed
+inline void ConsoleInput::refresh()
+{
+    if (!CONSOLE_REDRAW)
+        return;
+
+    flags.dirty = true;
+    if (!flags.in_batch)
+        deferred_update();
+}
+
+// Redraw a changed line once the input is idle or the redraw interval has passed
+// With a redraw interval a burst of keys costs one redraw per interval instead of one per key
+void ConsoleInput::deferred_update()
+{
+    if (!flags.dirty)
+        return;
 
-            switch (key)
+    if (redraw_interval > 0 && available() > 0 && millis() - last_redraw < redraw_interval)
+        return;
+
+    update();
+}
+
+// True when poll() has nothing to do: no input, no sequence waiting for its timeout,
+// no redraw and no log or queued output
+bool ConsoleInput::idle()
+{
+    return !input_waiting() && seq.state == SEQ_NONE && !flags.dirty && log_sink.pending() == 0 &&
+           frame.pending() == 0;
+}
+
+// Send the editor output, a dropped frame leaves the terminal unknown so the line is redrawn
+void ConsoleInput::send_frame()
+{
+    if (!frame.send())
+    {
+        shown.full = true;
+        flags.dirty = true;
+    }
+}
+
+// Write log output in place of the prompt, the prompt and the line are redrawn below it
+// by the next update, so several log writes cost one redraw
+// Unless send is set the output stays in the frame for the redraw that follows
+void ConsoleInput::write_log(const uint8_t *text, size_t len, bool send)
+{
+    if (stream == NULL || len == 0)
+        return;
+
+    if (frame.isNonBlocking())
+    {
+        // log lines are application output, a full queue drops frames so they bypass it
+        frame.flush();
+        if (!flags.log_shown)
+            stream->print(F(TERM_CLEAR_LINE));
+        stream->write(text, len);
+    }
+    else
+    {
+        if (!flags.log_shown)
+            frame.print(F(TERM_CLEAR_LINE));
+        frame.write(text, len);
+    }
+    flags.log_shown = true;
+    flags.log_open = text[len - 1] != '\n';
+
+    shown.full = true;
+    flags.dirty = true;
+    if (send)
+        send_frame();
+}
+
+// Remember the first character that differs from the terminal
+inline void ConsoleInput::mark_dirty(size_t pos)
+{
+    if (pos < shown.dirty)
+        shown.dirty = pos;
+}
+
+// Move the terminal cursor relative to its current position
+void ConsoleInput::move_caret(size_t from, size_t to)
+{
+    if (from == to)
+        return;
+
+    frame.print("\e[");
+    if (to > from)
+    {
+        if (to - from > 1)
+            frame.print(to - from);
+        frame.print('C');
+    }
+    else
+    {
+        if (from - to > 1)
+            frame.print(from - to);
+        frame.print('D');
+    }
+}
+
+// Clear the line and print the prompt and the complete input buffer
+void ConsoleInput::redraw_full()
+{
+    COUNT_STAT(full_redraws);
+    frame.print(F(TERM_CLEAR_LINE)); // Move all the way left + Clear the line
+    frame.print(prompt);
+
+    if (input_buf == NULL)
+        return;
+
+    if (CONSOLE_DEBUG && flags.debug_mode)
+    {
+
+        for (uint i = 0; i < input_buf_size; i++)
+        {
+            if (input_buf[i] == 0)
             {
-            case 'P':
-                // stream->println(F("F1"));
-                end_sequence();
-                return KEY_FN + 1;
-            case 'Q':
-                // stream->println(F("F2"));
-                end_sequence();
-                return KEY_FN + 2;
-            case 'R':
-                // stream->println(F("F3"));
-                end_sequence();
-                return KEY_FN + 3;
-            case 'S':
-                // stream->println(F("F4"));
-                end_sequence();
-                return KEY_FN + 4;
-            default:
-                if (stream != NULL)
-                    stream->println(F("UNKNOWN"));
-                return KEY_UNKNOWN;
+                frame.print("|");
             }
-            break;
-        } // CSO mode
+            else
+            {
+                frame.print((char)input_buf[i]);
+            }
+        }
+        frame.print(history_index);
+        frame.print("/");
+        frame.print(debugHistorycount());
+
+        frame.print("\e[1000D"); // Move all the way left again
+        frame.print("\e[");
+        frame.print(caret_pos + prompt_len); // Move caret to index
+        frame.print("C");
+        shown.full = true; // the debug dump is redrawn every time
+        return;
+    }
 
-        default:
-            print_sequence();
-            end_sequence();
-            return KEY_UNKNOWN;
+    write_line(0, line_len);
+    shown.len = line_len;
+    shown.caret = shown.len;
+    shown.full = false;
+    move_caret(shown.caret, caret_pos);
+    shown.caret = caret_pos;
+}
+
+// Print current input buffer
+// The redraw is collected in the frame buffer and sent with a single write
+void ConsoleInput::update()
+{
+    flags.dirty = false;
+
+    if (!CONSOLE_REDRAW || stream == NULL)
+        return;
+
+#if CONSOLE_STATS
+    uint32_t start = micros();
+#endif
+
+    redraw_line();
+    send_frame();
+    last_redraw = millis();
+
+#if CONSOLE_STATS
+    stats.redraws++;
+    count_time(stats.update_time, start);
+#endif
+}
+
+// Only the part of the line that changed since the last update is sent
+void ConsoleInput::redraw_line()
+{
+    // the prompt goes below the log output
+    if (flags.log_open)
+        frame.println();
+    flags.log_open = false;
+    flags.log_shown = false;
+
+    size_t dirty = shown.dirty;
+    shown.dirty = (size_t)-1;
+
+    if (CONSOLE_HISTORY && flags.searching)
+    {
+        redraw_search();
+        return;
+    }
+
+    if (input_buf == NULL || shown.full)
+    {
+        redraw_full();
+        return;
+    }
+
+    size_t len = line_len;
+    if (dirty > len)
+        dirty = len;
+
+    // rewrite from the first changed character and erase leftovers
+    if (dirty < len || len != shown.len)
+    {
+        move_caret(shown.caret, dirty);
+        write_line(dirty, len);
+        if (len < shown.len)
+            frame.print("\e[K");
+        shown.caret = len;
+        shown.len = len;
+    }
+
+    move_caret(shown.caret, caret_pos);
+    shown.caret = caret_pos;
+}
+
+// Read keys from another stream than the one the line is drawn on, e.g. a ConsoleRing
+// filled from an interrupt or another core. NULL reads from the console stream again.
+void ConsoleInput::setInput(Stream *source)
+{
+    input = source != NULL ? source : stream;
+    ring = NULL;
+}
+
+// Keys read from a ring are timed by the arrival of their first byte, not by the time they were
+// decoded, so the escape timeout and the event times do not include the time spent in the ring
+void ConsoleInput::setInput(ConsoleRing *source)
+{
+    setInput((Stream *)source);
+    ring = source;
+}
+
+// Limit redraws to one per interval while more input is waiting, 0 redraws after every key
+// The line is always redrawn as soon as the input is idle, so a single key is shown at once
+void ConsoleInput::setRedrawInterval(uint16_t ms)
+{
+    redraw_interval = ms;
+}
+
+// Keep editor output in a queue and only write what availableForWrite() of the stream allows
+// The queue is drained by readKey() and poll(). When it overflows, unsent redraws are dropped
+// and replaced by a full redraw. A NULL queue returns to blocking writes.
+// Application output through print() still waits until the queue has been written.
+void ConsoleInput::setNonBlocking(uint8_t *queue, size_t size)
+{
+    frame.setQueue(queue, size);
+}
+
+// Largest number of bytes waiting in the output queue, to size the queue
+size_t ConsoleInput::getOutputHighWater()
+{
+    return frame.highWater();
+}
+
+// Buffer for getLog(), complete log lines are written in one batch from readKey() and poll()
+// Without a buffer every print to the log is written at once
+void ConsoleInput::setLogBuffer(char *buffer, size_t size)
+{
+    flushLog();
+    log_sink.setBuffer(buffer, size);
+}
+
+// Print for log output, it is written above the prompt without disturbing the line being edited
+ConsoleLog &ConsoleInput::getLog()
+{
+    return log_sink;
+}
+
+// Write all buffered log output now, including a last line without line end
+void ConsoleInput::flushLog()
+{
+    log_sink.send(true);
+    if (flags.dirty && !flags.in_batch)
+        update();
+    send_frame();
+}
+
+// Dump escape sequences and the raw line buffer, only available with CONSOLE_DEBUG
+void ConsoleInput::setDebug(bool enable)
+{
+    flags.debug_mode = CONSOLE_DEBUG && enable;
+    shown.full = true;
+}
+
+// Set the prompt text, the string must remain valid while it is in use
+void ConsoleInput::setPrompt(const char *text)
+{
+    prompt = text != NULL ? text : "";
+    prompt_len = strlen(prompt);
+    shown.full = true;
+    shown.dirty = (size_t)-1;
+}
+
+// Size of the terminal, e.g. from the telnet NAWS option, the default is 80 x 24
+// The completion list is wrapped at the width, the line is redrawn completely by the next
+// readKey() or poll(). It may be called while the input is read.
+void ConsoleInput::setWindowSize(uint16_t columns, uint16_t rows)
+{
+    this->columns = columns > 0 ? columns : 80;
+    this->rows = rows > 0 ? rows : 24;
+    shown.full = true;
+    flags.dirty = true;
+}
+
+uint16_t ConsoleInput::getColumns()
+{
+    return columns;
+}
+
+uint16_t ConsoleInput::getRows()
+{
+    return rows;
+}
+
+// Ask the terminal to mark pasted text with "\e[200~" and "\e[201~", so a paste is inserted in bulk
+// and redrawn once instead of being decoded key by key. Only available with CONSOLE_PASTE.
+void ConsoleInput::setBracketedPaste(bool enable)
+{
+    if (!CONSOLE_PASTE || stream == NULL)
+        return;
+
+    if (enable)
+        frame.print(F("\e[?2004h"));
+    else
+        frame.print(F("\e[?2004l"));
+    frame.flush();
+}
+
+void ConsoleInput::setLineCallback(void (*callback)(const char *))
+{
+    // draw the prompt when the console was just created
+    if (flags.dirty)
+        update();
+
+    line_cb = callback;
+}
+
+// Get the input line as a zero terminated string
+const char *ConsoleInput::getLine()
+{
+    if (input_buf == NULL)
+        return NULL;
+
+    move_gap(line_len);
+    input_buf[line_len] = 0;
+    return input_buf;
+}
+
+// Deprecated: keys are read with readKey(), this returns the character of the line at index,
+// 0 past the end, without moving the gap like getLine()
+int16_t ConsoleInput::getChar(uint8_t index)
+{
+    return (uint8_t)char_at(index);
+}
+
+void ConsoleInput::clearLine()
+{
+    if (input_buf == NULL)
+        return;
+
+    line_len = 0;
+    gap_start = 0;
+    gap_end = input_buf_size;
+    mark_dirty(0);
+    setCaret(0);
+}
+
+// Read a key from the terminal or 0 if no key is available
+int16_t ConsoleInput::readKey()
+{
+#if CONSOLE_STATS
+    uint32_t start = micros();
+#endif
+
+    int16_t key = read_key();
+    if (events != NULL && is_special(key))
+        push_event(key);
+
+#if CONSOLE_STATS
+    if (key >= 0x20 && key < 0xff)
+        stats.keys_printable++;
+    else if (key > 0 && key < 0x20)
+        stats.keys_control++;
+    else if (key != KEY_BUFFERED && key != KEY_NONE && key != KEY_UNKNOWN)
+        stats.keys_special++;
+#endif
+
+    // poll() sends the output of all keys at once
+    if (!flags.in_batch)
+    {
+        log_sink.send(false);
+        deferred_update();
+        send_frame();
+    }
+
+#if CONSOLE_STATS
+    count_time(stats.read_time, start);
+#endif
+    return key;
+}
+
+int16_t ConsoleInput::read_key()
+{
+    if (flags.line_ready)
+    {
+        flags.line_ready = false;
+        clearLine();
+    }
+
+    int16_t key;
+
+    // flush sequence if it is not closed in timely fashion, bytes that are waiting belong to it
+    if (seq.state != SEQ_NONE && !input_waiting() && nextDeadline() == 0)
+    {
+        key = seq.state == SEQ_ESC ? KEY_ESC : KEY_UNKNOWN;
+        COUNT_STAT(sequences_flushed);
+        end_sequence();
+        key_mods = 0;
+        if (CONSOLE_HISTORY && key == KEY_ESC && flags.searching)
+            search_key(key);
+        return key;
+    }
+
+    // bytes held back by a preamble that did not match
+    key = CONSOLE_PASSTHROUGH ? held_byte() : -1;
+    uint32_t arrived = 0;
+    if (key < 0)
+    {
+        // no input available
+        if (input == NULL || !input->available())
+            return KEY_BUFFERED;
+
+        if (CONSOLE_PASTE && flags.pasting)
+            return read_paste();
+
+        if (CONSOLE_PASSTHROUGH && pass.state != PASS_OFF)
+            return read_passthrough();
+
+        if (ring != NULL)
+            arrived = ring->arrival();
+        key = input->read();
+        if (key < 0)
+            return KEY_BUFFERED;
+        COUNT_STAT(bytes_read);
+
+        if (CONSOLE_PASSTHROUGH && pass.preamble != NULL)
+        {
+            hold_preamble(key);
+            key = held_byte();
+            if (key < 0)
+                return KEY_BUFFERED;
         }
     }
 
-    end_sequence();
+    // time of the first byte of the key
+    if (seq.state == SEQ_NONE || key == 0x1b)
+        key_time = arrived != 0 ? arrived : micros();
+
+    // a TAB without progress lists the candidates when the next key is TAB too
+    bool double_tab = flags.tab_pending;
+    flags.tab_pending = false;
+
+    if (seq.state != SEQ_NONE)
+    {
+        if (key != 0x1b || seq.state == SEQ_ESC)
+            return decode_sequence(key);
+
+        // a new sequence starts before the previous one was closed
+        unknown_sequence();
+    }
+
+    if (key == 0x1b)
+    { /* escape sequence */
+        begin_sequence();
+        return KEY_BUFFERED;
+    }
+
+    key_mods = 0;
     if (key == 0x7f)
-        key = 7; // DEL = BACKSPACE
+        key = KEY_BACKSPACE; // DEL = BACKSPACE
+
+    if (CONSOLE_HISTORY && flags.searching && search_key(key))
+        return key;
 
     if (key >= 0x20 && key < 0xff)
     { // printable characters
-        if (flags.auto_edit)
+        if (CONSOLE_AUTO_EDIT)
             insertCharacter(key);
         return key;
     }
@@ -717,7 +1628,7 @@ int16_t ConsoleInput::readKey()
         switch (key)
         {                   // Ctrl + CHAR
         case KEY_CTRL('A'): // ^A = goto begin
-            if (input_buf != NULL && flags.auto_move)
+            if (input_buf != NULL && CONSOLE_AUTO_MOVE)
             {
                 setCaret(0);
             }
@@ -725,7 +1636,7 @@ int16_t ConsoleInput::readKey()
             break;
 
         case KEY_CTRL('B'): // ^B = go back a word
-            if (input_buf != NULL && flags.auto_move)
+            if (input_buf != NULL && CONSOLE_AUTO_MOVE)
             {
                 setCaret(0);
             }
@@ -736,18 +1647,22 @@ int16_t ConsoleInput::readKey()
             history_index = 0;
             break;
 
+        case KEY_CTRL('R'): // ^R = reverse history search
+            begin_search();
+            break;
+
         case KEY_CTRL('E'): // ^E = goto end
-            if (input_buf != NULL && flags.auto_move)
+            if (input_buf != NULL && CONSOLE_AUTO_MOVE)
             {
-                setCaret(strnlen(input_buf, input_buf_size));
+                setCaret(line_len);
             }
             history_index = 0;
             break;
 
         case KEY_CTRL('F'): // ^F = go forward a word
-            if (input_buf != NULL && flags.auto_move)
+            if (input_buf != NULL && CONSOLE_AUTO_MOVE)
             {
-                setCaret(strnlen(input_buf, input_buf_size));
+                setCaret(line_len);
             }
             history_index = 0;
             break;
@@ -756,48 +1671,583 @@ int16_t ConsoleInput::readKey()
             return key;
 
         case KEY_CTRL('H'): // Backspace
-            if (flags.auto_edit)
+            if (CONSOLE_AUTO_EDIT)
                 do_backspace();
             return KEY_BACKSPACE;
 
         case 9: // TAB
+            if (CONSOLE_AUTO_EDIT)
+                complete(double_tab);
             return key;
 
         case KEY_LF ... KEY_CR:
         { // LF, VT, FF, CR
             // handle CR/LF
-            if (key == KEY_CR && stream != NULL && stream->peek() == KEY_LF)
-                stream->read();
+            if (key == KEY_CR && input->peek() == KEY_LF)
+                input->read();
 
-            if (input_buf != NULL)
+            enter_line();
+            return key;
+        }
+
+        case 0x1a: // PAUSE
+            return KEY_PAUSE;
+        }
+        return key;
+    }
+
+    return KEY_UNKNOWN;
+}
+
+// Handle a completed line, readLine() returns it, otherwise it goes to the command or the line callback
+// Returns true when the line is kept for readLine()
+bool ConsoleInput::enter_line()
+{
+    // in a batch the line is not drawn yet, it is visible before its handler runs
+    if (flags.dirty)
+        update();
+
+    if (input_buf != NULL && flags.reading_line)
+    {
+        // readLine() returns the line, it is cleared by the next key
+        if (flags.auto_history)
+            pushLine();
+        flags.line_ready = true;
+        return true;
+    }
+
+    if (input_buf != NULL)
+    {
+        if (flags.auto_history)
+            pushLine();
+
+        // the handlers may write to the stream directly, without a queue this keeps the order
+        send_frame();
+
+        // the line is split in place, so it is always cleared after a command ran
+        if (dispatch())
+        {
+            clearLine();
+        }
+        // if (input_buf[0] != 0 && line_cb != NULL) // let the application handle or ignore empty lines
+        else if (line_cb != NULL)
+        {
+            line_cb(getLine());
+        }
+    }
+
+    if (flags.auto_clear)
+        clearLine();
+
+    return false;
+}
+
+// Read a bracketed paste up to its end marker "\e[201~" without decoding keys
+// Runs of characters are inserted in bulk, TAB is pasted as a space and other control
+// characters are dropped. Each pasted line is shown and entered like Enter was pressed,
+// the rest is redrawn once when the available input has been read.
+// Returns KEY_CR when readLine() took a line, the paste continues with the next call.
+int16_t ConsoleInput::read_paste()
+{
+    static const char end_marker[] = "\e[201~";
+    char run[32];
+    size_t run_len = 0;
+    int16_t key = KEY_BUFFERED;
+    bool batch = flags.in_batch;
+
+    flags.in_batch = true;
+    flags.tab_pending = false;
+    while (flags.pasting && !flags.line_ready && input->available() > 0)
+    {
+        int c = input->read();
+        if (c < 0)
+            break;
+        COUNT_STAT(bytes_read);
+
+        bool after_cr = flags.paste_cr;
+        flags.paste_cr = false;
+
+        if (c == (uint8_t)end_marker[paste_match])
+        {
+            if (++paste_match == sizeof(end_marker) - 1)
+                flags.pasting = false;
+            continue;
+        }
+
+        // bytes that only looked like the start of the end marker are pasted, except the ESC
+        uint8_t matched = paste_match;
+        paste_match = c == 0x1b ? 1 : 0;
+        if (run_len + matched + 1 > sizeof(run))
+        {
+            insert_text(run, run_len);
+            run_len = 0;
+        }
+        for (uint8_t i = 1; i < matched; i++)
+            run[run_len++] = end_marker[i];
+
+        if (c >= 0x20 && c != 0x7f)
+            run[run_len++] = c;
+        else if (c == '\t')
+            run[run_len++] = ' ';
+        else if (c == KEY_CR || c == KEY_LF)
+        {
+            insert_text(run, run_len);
+            run_len = 0;
+            if (c == KEY_LF && after_cr)
+                continue; // CR LF is one line end
+            flags.paste_cr = c == KEY_CR;
+            if (enter_line())
+                key = KEY_CR;
+        }
+    }
+    insert_text(run, run_len);
+    flags.in_batch = batch;
+
+    return key;
+}
+
+// ======== Passthrough =========================
+
+// Match the preamble, its bytes are held back until it is complete or a byte does not match
+void ConsoleInput::hold_preamble(uint8_t c)
+{
+    if (c == (uint8_t)pass.preamble[pass.match])
+    {
+        if (pass.preamble[++pass.match] == 0)
+        {
+            pass.match = 0;
+            beginPassthrough();
+        }
+        return;
+    }
+
+    // the longest tail of the held bytes and this one that starts the preamble stays held,
+    // like the fallback of KMP, the bytes before it are decoded as keys
+    uint8_t keep = pass.match;
+    while (keep > 0 && (c != (uint8_t)pass.preamble[keep - 1] ||
+                        memcmp(pass.preamble, pass.preamble + pass.match - keep + 1, keep - 1) != 0))
+        keep--;
+
+    pass.release = keep > 0 ? pass.match + 1 - keep : pass.match;
+    pass.next = keep > 0 ? -1 : c;
+    pass.match = keep;
+    pass.replay = 0;
+}
+
+// Next byte held back by a preamble that did not match, or -1
+int16_t ConsoleInput::held_byte()
+{
+    if (pass.replay < pass.release)
+        return (uint8_t)pass.preamble[pass.replay++];
+
+    int16_t c = pass.next;
+    pass.next = -1;
+    pass.release = 0;
+    pass.replay = 0;
+    return c;
+}
+
+// Read the available bytes of a passthrough block and pass them to the callback
+// Length framed data is copied in bulk. Without an application buffer the data is passed
+// in small chunks as it arrives, with a buffer when the buffer is full or the block ends.
+int16_t ConsoleInput::read_passthrough()
+{
+    uint8_t chunk[32];
+    uint8_t *out = pass.buffer != NULL ? pass.buffer : chunk;
+    size_t size = pass.buffer != NULL ? pass.size : sizeof(chunk);
+
+    while (pass.state != PASS_OFF && input->available() > 0)
+    {
+        if (pass.len == size)
+        {
+            if (pass.callback != NULL)
+                pass.callback(out, pass.len, false);
+            pass.len = 0;
+        }
+
+        if (pass.state == PASS_DATA)
+        {
+            size_t count = size - pass.len;
+            if (count > pass.left)
+                count = pass.left;
+            if (count > (size_t)input->available())
+                count = input->available();
+
+            count = input->readBytes((char *)out + pass.len, count);
+            if (count == 0)
+                break;
+#if CONSOLE_STATS
+            stats.bytes_read += count;
+#endif
+            pass.len += count;
+            pass.left -= count;
+            if (pass.left == 0)
+                pass.state = PASS_OFF;
+            continue;
+        }
+
+        int c = input->read();
+        if (c < 0)
+            break;
+        COUNT_STAT(bytes_read);
+
+        switch (pass.state)
+        {
+        case PASS_LENGTH_HIGH:
+            pass.left = (size_t)c << 8;
+            pass.state = PASS_LENGTH_LOW;
+            break;
+
+        case PASS_LENGTH_LOW:
+            pass.left |= c;
+            pass.state = pass.left > 0 ? PASS_DATA : PASS_OFF;
+            break;
+
+        case PASS_GROUP:
+            if (c == 0)
+            { // end of the block, a zero due after the last group is not part of the data
+                pass.state = PASS_OFF;
+            }
+            else if (pass.left == 0)
+            { // code byte, the group has code - 1 data bytes and is followed by a zero unless code is 0xff
+                if (pass.zero)
+                    out[pass.len++] = 0;
+                pass.zero = c < 0xff;
+                pass.left = c - 1;
+            }
+            else
             {
-                // if (input_buf[0] != 0 && line_cb != NULL) // let the application handle or ignore empty lines
-                if (line_cb != NULL)
-                {
-                    line_cb(input_buf);
-                }
+                out[pass.len++] = c;
+                pass.left--;
             }
+            break;
+        }
+    }
+
+    if (pass.state == PASS_OFF || pass.buffer == NULL)
+    {
+        if (pass.callback != NULL && (pass.state == PASS_OFF || pass.len > 0))
+            pass.callback(out, pass.len, pass.state == PASS_OFF);
+        pass.len = 0;
+    }
+
+    return KEY_BUFFERED;
+}
+
+// Pass binary blocks from the stream to callback instead of decoding them as keys
+// A block starts when the preamble is received or beginPassthrough() is called and ends after
+// the length or the COBS frame given by framing, then the console resumes. The callback gets
+// the data in chunks, end is set on the last one. With a buffer the chunks are up to size bytes,
+// e.g. a complete block. The preamble must remain valid, its bytes are held back until it
+// either matches or not, so it should start with a byte that is not typed.
+void ConsoleInput::setPassthrough(void (*callback)(const uint8_t *data, size_t len, bool end), uint8_t framing,
+                                  const char *preamble, uint8_t *buffer, size_t size)
+{
+    pass.callback = callback;
+    pass.framing = framing;
+    pass.preamble = CONSOLE_PASSTHROUGH && preamble != NULL && preamble[0] != 0 ? preamble : NULL;
+    pass.buffer = buffer != NULL && size > 0 ? buffer : NULL;
+    pass.size = pass.buffer != NULL ? size : 0;
+    pass.state = PASS_OFF;
+    pass.match = 0;
+    pass.release = 0;
+    pass.replay = 0;
+    pass.next = -1;
+    pass.len = 0;
+}
+
+// Read the next bytes as a passthrough block, e.g. from a command that starts a transfer
+void ConsoleInput::beginPassthrough()
+{
+    if (!CONSOLE_PASSTHROUGH)
+        return;
+
+    end_sequence();
+    pass.state = pass.framing == PASS_COBS ? PASS_GROUP : PASS_LENGTH_HIGH;
+    pass.left = 0;
+    pass.zero = false;
+    pass.len = 0;
+}
+
+// Abort a passthrough block, data that was not passed to the callback is dropped
+void ConsoleInput::endPassthrough()
+{
+    pass.state = PASS_OFF;
+    pass.len = 0;
+}
+
+bool ConsoleInput::inPassthrough()
+{
+    return pass.state != PASS_OFF;
+}
+
+// ======== Key Events =========================
+
+// Printable characters are already handled by the line editor, other keys are for the application
+inline bool ConsoleInput::is_special(int16_t key)
+{
+    return key != KEY_BUFFERED && key != KEY_NONE && !(key >= 0x20 && key < 0xff);
+}
+
+// Queue a special key, it is counted as lost when the queue is full
+void ConsoleInput::push_event(int16_t key)
+{
+    if (event_count == event_size)
+    {
+        events_lost++;
+        return;
+    }
+
+    ConsoleEvent &event = events[(event_first + event_count) % event_size];
+    event.key = key;
+    event.modifiers = key_mods;
+    event.time = key_time;
+    event_count++;
+}
+
+// Record every special key with its modifiers and the micros() of its first byte
+// The queue is filled by readKey() and poll() and emptied with readEvents()
+void ConsoleInput::setEventQueue(ConsoleEvent *queue, size_t size)
+{
+    events = queue != NULL && size > 0 ? queue : NULL;
+    event_size = events != NULL ? size : 0;
+    event_first = 0;
+    event_count = 0;
+    events_lost = 0;
+}
+
+// Move up to max queued events to out, oldest first, returns the number of events
+size_t ConsoleInput::readEvents(ConsoleEvent *out, size_t max)
+{
+    size_t count = 0;
+    while (count < max && event_count > 0)
+    {
+        out[count++] = events[event_first];
+        event_first = (event_first + 1) % event_size;
+        event_count--;
+    }
+    return count;
+}
+
+// Number of events that did not fit in the queue
+size_t ConsoleInput::getLostEvents()
+{
+    return events_lost;
+}
+
+// ======== Statistics =========================
+
+// Add the time since start to an execution time histogram
+void ConsoleInput::count_time(uint32_t *histogram, uint32_t start)
+{
+    uint32_t elapsed = micros() - start;
+    uint8_t bucket = 0;
+    for (uint32_t limit = 1; bucket < CONSOLE_STATS_BUCKETS - 1 && elapsed >= limit; limit <<= 2)
+        bucket++;
+    histogram[bucket]++;
+}
+
+// Copy of the counters, all zero without CONSOLE_STATS
+void ConsoleInput::getStats(ConsoleStats &out)
+{
+#if CONSOLE_STATS
+    out = stats;
+    out.bytes_written = frame.counters.bytes;
+    out.blocked_writes = frame.counters.blocked;
+    out.dropped_frames = frame.counters.dropped;
+#else
+    memset(&out, 0, sizeof(out));
+#endif
+}
+
+void ConsoleInput::resetStats()
+{
+#if CONSOLE_STATS
+    memset(&stats, 0, sizeof(stats));
+    memset(&frame.counters, 0, sizeof(frame.counters));
+#endif
+}
 
-            // if(flags.auto_history) pushHistoryLine(input_buf);
+// Names of the ConsoleStats counters, in order and padded to STAT_NAME_WIDTH
+#define STAT_NAME_WIDTH 20
+static const char stat_names[] PROGMEM =
+    "bytes read          "
+    "printable keys      "
+    "control keys        "
+    "special keys        "
+    "unknown sequences   "
+    "flushed sequences   "
+    "redraws             "
+    "full redraws        "
+    "bytes written       "
+    "blocked writes      "
+    "dropped frames      "
+    "history pushes      "
+    "history recalls     "
+    "history searches    ";
+
+// Print the counters and histograms, e.g. from a stats command
+void ConsoleInput::printStats(Print &out)
+{
+    ConsoleStats now;
+    getStats(now);
+
+    const uint32_t *counter = &now.bytes_read;
+    for (size_t i = 0; i < sizeof(stat_names) / STAT_NAME_WIDTH; i++)
+    {
+        for (size_t c = 0; c < STAT_NAME_WIDTH; c++)
+            out.print((char)pgm_read_byte(stat_names + i * STAT_NAME_WIDTH + c));
+        out.printf_P(PSTR(" %10lu\r\n"), (unsigned long)counter[i]);
+    }
+
+    out.printf_P(PSTR("%-20s %10s %10s\r\n"), "time (us)", "readKey", "update");
+    uint32_t limit = 1;
+    for (uint8_t i = 0; i < CONSOLE_STATS_BUCKETS; i++, limit <<= 2)
+    {
+        if (i < CONSOLE_STATS_BUCKETS - 1)
+            out.printf_P(PSTR("< %-18lu"), (unsigned long)limit);
+        else
+            out.printf_P(PSTR(">= %-17lu"), (unsigned long)(limit >> 2));
+        out.printf_P(PSTR(" %10lu %10lu\r\n"), (unsigned long)now.read_time[i], (unsigned long)now.update_time[i]);
+    }
+}
+
+// ======== Blocking Input =========================
 
-            if (flags.auto_clear)
-                clearLine();
+// Wake up waitKey() and readLine() through a notifier instead of checking the input every ms
+// The notifier must be notified by the code that receives the input, e.g. ConsoleRing::setNotifier()
+void ConsoleInput::setNotifier(ConsoleNotifier *source)
+{
+    notifier = source;
+}
 
-            // size_t numchars = 1;
-            // memmove(input_buf + numchars, input_buf,
-            //         input_buf_size - numchars); // Shift chars right
+// Milliseconds to sleep at most, a pending escape sequence must be flushed in time
+uint32_t ConsoleInput::wait_time(uint32_t remaining)
+{
+    uint32_t deadline = nextDeadline();
+    if (deadline == NO_DEADLINE)
+        return remaining;
 
-            // history_index = 0;
-            // debugShowHistory();
+    uint32_t flush = deadline / 1000 + 1;
+    return flush < remaining ? flush : remaining;
+}
 
+// Input bytes, or bytes held back by a preamble, that readKey() has not decoded yet
+bool ConsoleInput::input_waiting()
+{
+    return (input != NULL && input->available() > 0) ||
+           (CONSOLE_PASSTHROUGH && (pass.replay < pass.release || pass.next >= 0));
+}
+
+// Microseconds until readKey() must be called, so event-driven callers can sleep until then
+// 0 when input is waiting or a pending escape sequence is due, NO_DEADLINE when nothing is pending
+uint32_t ConsoleInput::nextDeadline()
+{
+    if (input_waiting())
+        return 0;
+
+    if (seq.state == SEQ_NONE)
+        return NO_DEADLINE;
+
+    uint32_t waited = micros() - key_time;
+    return waited < escape_timeout ? escape_timeout - waited : 0;
+}
+
+// Time a lone ESC or an unfinished escape sequence may take, from its first byte
+// Lower values make the ESC key respond faster, over slow or bursty links sequences
+// may be split by the timeout. The default is 250 ms.
+void ConsoleInput::setEscapeTimeout(uint32_t us)
+{
+    escape_timeout = us;
+}
+
+// Wait up to timeout_ms for a key and return it, or 0 on timeout
+int16_t ConsoleInput::waitKey(uint32_t timeout_ms)
+{
+    uint32_t start = millis();
+    for (;;)
+    {
+        int16_t key = readKey();
+        if (key != KEY_BUFFERED)
             return key;
-        }
 
-        case 0x1a: // PAUSE
-            return KEY_PAUSE;
-        }
-        return key;
+        // the rest of an escape sequence is already there
+        if (input != NULL && input->available() > 0)
+            continue;
+
+        uint32_t elapsed = millis() - start;
+        if (elapsed >= timeout_ms)
+            return KEY_BUFFERED;
+
+        uint32_t sleep = wait_time(timeout_ms - elapsed);
+        if (notifier != NULL)
+            notifier->wait(sleep);
+        else
+            delay(1);
     }
+}
 
-    return KEY_UNKNOWN;
+// Wait up to timeout_ms for a complete line and return it, or NULL on timeout
+// The line is edited as usual but not passed to the commands or the line callback.
+// It remains valid until the next key is read.
+const char *ConsoleInput::readLine(uint32_t timeout_ms)
+{
+    if (input_buf == NULL)
+        return NULL;
+
+    if (flags.line_ready)
+    {
+        flags.line_ready = false;
+        clearLine();
+    }
+
+    uint32_t start = millis();
+    flags.reading_line = true;
+    while (!flags.line_ready)
+    {
+        uint32_t elapsed = millis() - start;
+        if (elapsed >= timeout_ms)
+            break;
+        waitKey(timeout_ms - elapsed);
+    }
+    flags.reading_line = false;
+
+    return flags.line_ready ? getLine() : NULL;
+}
+
+// Decode all input that is currently available, within the given budgets
+// max_bytes and max_ms limit the work done in one call, 0 means no limit
+// Edits are applied without intermediate redraws, the line is redrawn once at the end
+// (with a redraw interval it waits for idle input or the interval when the budget ran out)
+// Special keys are stored in keys (up to max_keys), the number of special keys seen is returned
+size_t ConsoleInput::poll(size_t max_bytes, uint16_t max_ms, int16_t *keys, size_t max_keys)
+{
+    size_t count = 0;
+    size_t consumed = 0;
+    uint32_t start = millis();
+
+    flags.in_batch = true;
+    do
+    {
+        int before = available();
+        int16_t key = readKey();
+        int after = available();
+        if (before > after)
+            consumed += before - after;
+
+        if (is_special(key))
+        {
+            if (keys != NULL && count < max_keys)
+                keys[count] = key;
+            count++;
+        }
+    } while (available() > 0 && (max_bytes == 0 || consumed < max_bytes) &&
+             (max_ms == 0 || millis() - start < max_ms));
+    flags.in_batch = false;
+
+    log_sink.send(false);
+    deferred_update();
+    send_frame();
+
+    return count;
 }
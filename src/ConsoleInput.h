@@ -5,42 +5,214 @@
 #define _CONSOLEINPUT_H
 
 #include <Arduino.h>
+#include "ConsoleConfig.h"
+#include "ConsoleFrame.h"
+#include "ConsoleHistory.h"
+#include "ConsoleLog.h"
+#include "ConsoleNotifier.h"
+#include "ConsoleRing.h"
 
 #define TERM_CLEAR_LINE "\e[1000D\e[0K"
 
+// Entry of the command table, the table must be sorted by name
+struct ConsoleCommand
+{
+  const char *name;
+  void (*handler)(int argc, char *argv[]);
+};
+
+// Special key with its modifiers and the micros() of its first byte
+struct ConsoleEvent
+{
+  int16_t key;
+  int16_t modifiers;
+  uint32_t time;
+};
+
+// Counters and execution time histograms, only collected with CONSOLE_STATS
+// Bucket 0 counts calls under 1 us, bucket n calls under 4^n us, the last bucket all slower calls
+struct ConsoleStats
+{
+  uint32_t bytes_read;
+  uint32_t keys_printable;
+  uint32_t keys_control; // Enter, Backspace, TAB and other control characters
+  uint32_t keys_special; // cursor, function and modified keys
+  uint32_t sequences_unknown;
+  uint32_t sequences_flushed; // unfinished sequences flushed by the escape timeout
+  uint32_t redraws;
+  uint32_t full_redraws;
+  uint32_t bytes_written;
+  uint32_t blocked_writes; // writes larger than availableForWrite() of the stream
+  uint32_t dropped_frames; // redraws dropped from a full non-blocking queue
+  uint32_t history_pushes;
+  uint32_t history_recalls;
+  uint32_t history_searches;
+  uint32_t read_time[CONSOLE_STATS_BUCKETS];   // readKey() execution time
+  uint32_t update_time[CONSOLE_STATS_BUCKETS]; // update() execution time
+};
+
 class ConsoleInput : public Stream
 {
+  friend class ConsoleLog;
+  friend class ConsoleServer;
 
 private:
   Stream *stream;
+  Stream *input;      // source of the keys, stream unless set with setInput()
+  ConsoleRing *ring;  // input when it is a ring, for the arrival time of the keys
+  ConsoleFrame frame; // terminal output of the editor, written to stream in bulk
 
-  char esc_sequence[10]; // escape sequence buffer
-  char *input_buf;       // input buffer and with history
+  char esc_sequence[10]; // raw escape sequence, only used for debug output
+  char *input_buf;       // input buffer
   size_t input_buf_size;
+  size_t line_len;  // number of characters on the line
+  size_t gap_start; // first free position of the gap buffer
+  size_t gap_end;   // first character after the gap
   size_t caret_pos;
-  size_t history_index;
-  uint16_t last_read;
+  size_t history_index; // recalled history entry, 0 is the line being edited
+  ConsoleHistory own_history;
+  ConsoleHistory *history;
+  ConsoleLog log_sink; // log output waiting to be written above the prompt
+  ConsoleNotifier *notifier;
+  size_t recall_prefix;  // length of the prefix for prefix recall
+  uint16_t search_match; // reverse search match being shown
+  uint32_t escape_timeout; // us from the first byte until an unfinished sequence is flushed
+  uint32_t last_redraw;     // millis() of the last update
+  uint16_t redraw_interval; // minimum ms between redraws while input is pending
 
   struct
   {
     bool insert_mode : 1;
     bool debug_mode : 1;
     bool enable_history : 1;
-    bool auto_update : 1;
-    bool auto_edit : 1;
-    bool auto_move : 1;
     bool auto_clear : 1;
     bool auto_history : 1;
+    bool in_batch : 1;
+    bool dirty : 1;
+    bool searching : 1;
+    bool prefix_recall : 1;
+    bool tab_pending : 1;
+    bool owns_buffer : 1;
+    bool log_shown : 1; // log output replaced the prompt on the terminal
+    bool log_open : 1;  // the last log line has no line end yet
+    bool reading_line : 1;
+    bool line_ready : 1; // readLine() returned the line, clear it on the next key
+    bool pasting : 1;    // inside a bracketed paste
+    bool paste_cr : 1;   // the last pasted byte was a CR, a following LF is skipped
+    bool own_completion : 1; // setCompletion() set the words, the command table is not completed
   } flags;
 
+  struct
+  {
+    uint8_t state;     // position in the escape sequence state machine
+    uint8_t length;    // number of raw bytes in esc_sequence
+    uint8_t count;     // index of the parameter being parsed
+    bool extended;     // private or intermediate bytes seen
+    uint16_t param[2]; // numeric CSI parameters
+  } seq;
+  struct
+  {
+    uint8_t framing;
+    uint8_t state;        // part of the block being read, PASS_OFF outside a block
+    uint8_t match;        // bytes of the preamble matched and held back
+    uint8_t release;      // held bytes decoded as keys after the preamble did not match
+    uint8_t replay;       // released bytes decoded so far
+    int16_t next;         // byte that broke the match, decoded after them, -1 for none
+    bool zero;            // COBS: a zero byte is due before the next group
+    size_t left;          // bytes left in the block or the COBS group
+    size_t len;           // bytes in buffer
+    size_t size;
+    uint8_t *buffer;      // application buffer or NULL to pass the data as it arrives
+    const char *preamble; // switches to passthrough when received, NULL for none
+    void (*callback)(const uint8_t *data, size_t len, bool end);
+  } pass;
+  int16_t key_mods;
+  uint8_t paste_match; // bytes of the paste end marker seen
+  uint32_t key_time; // micros() of the arrival of the first byte of the key being decoded
+
+#if CONSOLE_STATS
+  ConsoleStats stats;
+#endif
+
+  ConsoleEvent *events; // queue of special keys for readEvents()
+  size_t event_size;
+  size_t event_first;
+  size_t event_count;
+  size_t events_lost;
+
+  const char *prompt;
+  size_t prompt_len;
+  uint16_t columns; // terminal width, for the completion list
+  uint16_t rows;
+
+  struct
+  {
+    size_t len;   // characters of the line shown on the terminal
+    size_t caret; // caret position shown on the terminal
+    size_t dirty; // first changed character since the last redraw
+    bool full;    // terminal contents unknown, redraw prompt and line
+  } shown;
+
+  void init(Stream *serial, char *buffer, size_t size, bool enable_history);
+  int16_t read_key();
+  int16_t read_paste();
+  int16_t read_passthrough();
+  void hold_preamble(uint8_t c);
+  int16_t held_byte();
+  uint32_t wait_time(uint32_t remaining);
+  bool input_waiting();
+  bool is_special(int16_t key);
+  void push_event(int16_t key);
+  void count_time(uint32_t *histogram, uint32_t start);
+
+  void begin_sequence(void);
   void end_sequence(void);
   void print_sequence(void);
-  int16_t add_sequence();
+  void add_sequence(uint8_t c);
+  int16_t decode_sequence(uint8_t c);
+  int16_t finish_sequence(uint8_t c);
+  int16_t unknown_sequence(void);
+  int16_t special_key(int16_t key);
 
   void (*line_cb)(const char *);
 
+  const ConsoleCommand *commands; // sorted command table, possibly in PROGMEM
+  size_t command_count;
+
+  const uint8_t *completion; // sorted completion words, possibly in PROGMEM
+  size_t completion_count;
+  size_t completion_stride; // bytes between two word pointers
+
+  void move_gap(size_t pos);
+  char char_at(size_t pos);
+  void write_line(size_t from, size_t to);
+  void recall_history(size_t index);
+  void step_history(bool older);
+  void write_history(uint16_t entry);
+  void search_history(bool narrow);
+  uint16_t search_entry(uint16_t num);
+  void begin_search();
+  void end_search(bool accept);
+  bool search_key(int16_t key);
+  void redraw_search();
+  const char *completion_word(size_t index);
+  size_t completion_bound(const char *prefix, size_t len, bool past);
+  void complete(bool list);
+  int32_t find_command(const char *name, size_t len);
+  bool dispatch();
+  bool enter_line();
+  void insert_text(const char *text, size_t len);
   void do_backspace();
   void do_delete();
+  void refresh();
+  void deferred_update();
+  bool idle();
+  void send_frame();
+  void write_log(const uint8_t *text, size_t len, bool send);
+  void mark_dirty(size_t pos);
+  void move_caret(size_t from, size_t to);
+  void redraw_full();
+  void redraw_line();
 
 public:
   // Declaration, initialization.
@@ -71,12 +243,32 @@ public:
   static const int MOD_ALT = 1 << 13;
   static const int MOD_ALT_GR = 1 << 14;
   static const int KEY_FN = -512;
+  static const uint32_t NO_DEADLINE = 0xffffffff;
 
-  ConsoleInput(Stream *serial, size_t size = 0);
+  static const uint8_t PASS_LENGTH = 0; // two byte length, most significant byte first, then the data
+  static const uint8_t PASS_COBS = 1;   // COBS encoded data ending with a zero byte
+
+  ConsoleInput(Stream *serial, size_t size = 0, size_t history_size = 0, uint16_t history_entries = 16);
+  ConsoleInput(Stream *serial, char *buffer, size_t size, char *history_buffer = NULL, size_t history_size = 0,
+               uint16_t *history_index = NULL, uint16_t history_entries = 0);
   virtual ~ConsoleInput();
 
   int16_t readKey();
-  int16_t getChar(uint8_t index);
+  size_t poll(size_t max_bytes = 0, uint16_t max_ms = 0, int16_t *keys = NULL, size_t max_keys = 0);
+  int16_t getModifiers(void);
+  int16_t waitKey(uint32_t timeout_ms);
+  uint32_t nextDeadline();
+  void setEscapeTimeout(uint32_t us);
+  const char *readLine(uint32_t timeout_ms);
+  void setNotifier(ConsoleNotifier *source);
+
+  void setEventQueue(ConsoleEvent *queue, size_t size);
+  size_t readEvents(ConsoleEvent *out, size_t max);
+  size_t getLostEvents();
+
+  void getStats(ConsoleStats &out);
+  void resetStats();
+  void printStats(Print &out);
 
   bool insertCharacter(char ch);
   bool insertCharacter(char ch, size_t pos);
@@ -84,10 +276,36 @@ public:
   void setCaret(int16_t index);
   int16_t getCaret(void);
   void update(void);
+  void setInput(Stream *source);
+  void setInput(ConsoleRing *source);
+  void setRedrawInterval(uint16_t ms);
+  void setNonBlocking(uint8_t *queue, size_t size);
+  size_t getOutputHighWater();
+  void setPrompt(const char *text);
+  void setBracketedPaste(bool enable);
+  void setWindowSize(uint16_t columns, uint16_t rows);
+  uint16_t getColumns();
+  uint16_t getRows();
+  void setPassthrough(void (*callback)(const uint8_t *data, size_t len, bool end), uint8_t framing,
+                      const char *preamble = NULL, uint8_t *buffer = NULL, size_t size = 0);
+  void beginPassthrough();
+  void endPassthrough();
+  bool inPassthrough();
+  void setDebug(bool enable);
+
+  void setLogBuffer(char *buffer, size_t size);
+  ConsoleLog &getLog();
+  void flushLog();
 
   void setLineCallback(void (*callback)(const char *));
+  void setCompletion(const char *const *words, size_t count);
+  void setCommands(const ConsoleCommand *commands, size_t count);
+  static int tokenize(char *line, char *argv[], int max_args);
   const char *getLine();
+  int16_t getChar(uint8_t index) __attribute__((deprecated("use getLine()")));
   void pushLine();
+  void setHistory(ConsoleHistory *shared);
+  void setPrefixRecall(bool enable);
   void clearLine();
 
   size_t debugHistorycount();
@@ -99,8 +317,37 @@ public:
   virtual int read(void);
   virtual void flush(void);
   virtual size_t write(uint8_t);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual size_t readBytes(char *buffer, size_t length);
 
   using Print::write;
+  using Stream::readBytes;
+};
+
+// Storage of StaticConsoleInput, a base class so it exists before ConsoleInput is constructed
+template <size_t Size, size_t HistorySize, uint16_t HistoryEntries> struct StaticConsoleStorage
+{
+  static_assert(Size >= 2, "the line needs room for one character and the terminating zero");
+  static_assert(HistorySize <= 0xffff, "history offsets are 16-bit");
+  static_assert(HistorySize == 0 || HistoryEntries > 0, "the history needs at least one entry");
+
+  char line_storage[Size];
+  char history_storage[HistorySize > 0 ? HistorySize : 1];
+  uint16_t index_storage[HistorySize > 0 ? HistoryEntries * 4 : 1]; // see ConsoleHistory::indexWords()
+};
+
+// ConsoleInput with the line and history stored inside the object, without heap allocation
+template <size_t Size, size_t HistorySize = 0, uint16_t HistoryEntries = 16>
+class StaticConsoleInput : private StaticConsoleStorage<Size, HistorySize, HistoryEntries>, public ConsoleInput
+{
+  typedef StaticConsoleStorage<Size, HistorySize, HistoryEntries> Storage;
+
+public:
+  StaticConsoleInput(Stream *serial)
+      : ConsoleInput(serial, Storage::line_storage, Size, HistorySize > 0 ? Storage::history_storage : NULL,
+                     HistorySize, Storage::index_storage, HistoryEntries)
+  {
+  }
 };
 
 #endif
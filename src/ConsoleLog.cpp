@@ -0,0 +1,80 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleLog.h"
+#include "ConsoleInput.h"
+
+ConsoleLog::ConsoleLog(ConsoleInput *owner)
+{
+    console = owner;
+    buf = NULL;
+    size = 0;
+    len = 0;
+    complete = 0;
+}
+
+// Buffer to collect log lines in, NULL shows every write at once
+void ConsoleLog::setBuffer(char *buffer, size_t bytes)
+{
+    send(true);
+    buf = buffer;
+    size = buffer != NULL ? bytes : 0;
+}
+
+// Number of bytes waiting to be written
+size_t ConsoleLog::pending(void)
+{
+    return len;
+}
+
+// Write the buffered lines above the prompt, a partial last line only when all is set
+// The console sends them together with the redraw that follows
+void ConsoleLog::send(bool all)
+{
+    size_t count = all ? len : complete;
+    if (count == 0)
+        return;
+
+    console->write_log((const uint8_t *)buf, count, false);
+    memmove(buf, buf + count, len - count);
+    len -= count;
+    complete = 0;
+}
+
+size_t ConsoleLog::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ConsoleLog::write(const uint8_t *buffer, size_t count)
+{
+    if (len + count > size)
+    {
+        send(true);
+
+        // larger than the buffer, show it at once
+        if (count > size)
+        {
+            console->write_log(buffer, count, true);
+            return count;
+        }
+    }
+
+    memcpy(buf + len, buffer, count);
+    for (size_t i = count; i > 0; i--)
+    {
+        if (buffer[i - 1] == '\n')
+        {
+            complete = len + i;
+            break;
+        }
+    }
+    len += count;
+    return count;
+}
+
+// Write all buffered log output now
+void ConsoleLog::flush(void)
+{
+    send(true);
+}
@@ -0,0 +1,39 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLELOG_H
+#define _CONSOLELOG_H
+
+#include <Arduino.h>
+
+class ConsoleInput;
+
+// Print that collects log output and lets the console write it above the prompt
+// Complete lines are written in one batch from readKey() or poll(), followed by
+// a single redraw of the prompt and the line being edited. Without a buffer
+// every write is shown at once and the prompt is redrawn by the next readKey().
+class ConsoleLog : public Print
+{
+
+private:
+  ConsoleInput *console;
+  char *buf;
+  size_t size;
+  size_t len;      // bytes in buf
+  size_t complete; // bytes of complete lines in buf
+
+public:
+  ConsoleLog(ConsoleInput *owner);
+
+  void setBuffer(char *buffer, size_t size);
+  size_t pending(void);
+  void send(bool all);
+
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual void flush(void);
+
+  using Print::write;
+};
+
+#endif
@@ -0,0 +1,39 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleNotifier.h"
+
+#if defined(ESP32)
+
+// The waiting task is taken from the first call to wait() unless it is given here
+ConsoleTaskNotifier::ConsoleTaskNotifier(TaskHandle_t waiter)
+{
+    task = waiter;
+}
+
+bool ConsoleTaskNotifier::wait(uint32_t timeout_ms)
+{
+    task = xTaskGetCurrentTaskHandle();
+    return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0;
+}
+
+void ConsoleTaskNotifier::notify(void)
+{
+    TaskHandle_t waiter = task;
+    if (waiter == NULL)
+        return;
+
+    if (xPortInIsrContext())
+    {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(waiter, &woken);
+        if (woken)
+            portYIELD_FROM_ISR();
+    }
+    else
+    {
+        xTaskNotifyGive(waiter);
+    }
+}
+
+#endif
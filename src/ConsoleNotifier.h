@@ -0,0 +1,39 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLENOTIFIER_H
+#define _CONSOLENOTIFIER_H
+
+#include <Arduino.h>
+
+// Wakes a task blocked in ConsoleInput::waitKey() or readLine() when input arrives
+// notify() is called by whoever receives the bytes, e.g. a ConsoleRing producer
+// or a serial receive callback, wait() by the console task.
+class ConsoleNotifier
+{
+public:
+  virtual ~ConsoleNotifier() {}
+
+  // Sleep until notified or until timeout_ms passed, returns false on timeout
+  // A notification that arrived before the call returns at once
+  virtual bool wait(uint32_t timeout_ms) = 0;
+  virtual void notify(void) = 0;
+};
+
+#if defined(ESP32)
+// FreeRTOS task notification of the task that waits, notify() may be called from an ISR
+class ConsoleTaskNotifier : public ConsoleNotifier
+{
+
+private:
+  TaskHandle_t volatile task;
+
+public:
+  ConsoleTaskNotifier(TaskHandle_t waiter = NULL);
+
+  virtual bool wait(uint32_t timeout_ms);
+  virtual void notify(void);
+};
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleRecorder.h"
+
+const uint32_t ConsoleRecorder::MERGE_TIME;
+
+// Record the traffic of wrapped to out, e.g. a file or a second serial port
+ConsoleRecorder::ConsoleRecorder(Stream *wrapped, Print *out)
+{
+    stream = wrapped;
+    trace = out;
+    last_time = 0;
+    pending_time = 0;
+    pending_len = 0;
+    pending_output = false;
+    started = false;
+}
+
+// Add bytes to the trace, the current record is written when the direction changes,
+// when it is full or when it is older than MERGE_TIME
+void ConsoleRecorder::record(bool output, const uint8_t *data, size_t len)
+{
+    if (trace == NULL)
+        return;
+
+    uint32_t now = micros();
+    for (size_t i = 0; i < len; i++)
+    {
+        if (pending_len > 0 && (pending_output != output || pending_len == sizeof(pending) ||
+                                now - pending_time > MERGE_TIME))
+            emit();
+
+        if (pending_len == 0)
+        {
+            pending_time = now;
+            pending_output = output;
+        }
+        pending[pending_len++] = data[i];
+    }
+}
+
+// Write the record being collected
+void ConsoleRecorder::emit(void)
+{
+    if (pending_len == 0)
+        return;
+
+    if (!started)
+    {
+        trace->write((const uint8_t *)"CIT1", 4);
+        last_time = pending_time;
+        started = true;
+    }
+
+    uint8_t head[6];
+    size_t count = 0;
+    head[count++] = (pending_output ? 0x80 : 0) | (pending_len - 1);
+
+    uint32_t delta = pending_time - last_time;
+    do
+    {
+        head[count++] = (delta & 0x7f) | (delta > 0x7f ? 0x80 : 0);
+        delta >>= 7;
+    } while (delta > 0);
+
+    trace->write(head, count);
+    trace->write(pending, pending_len);
+    last_time = pending_time;
+    pending_len = 0;
+}
+
+// Write the last record, call before the trace is closed
+void ConsoleRecorder::flushTrace(void)
+{
+    if (trace != NULL)
+        emit();
+}
+
+int ConsoleRecorder::available(void)
+{
+    return stream != NULL ? stream->available() : 0;
+}
+
+int ConsoleRecorder::peek(void)
+{
+    return stream != NULL ? stream->peek() : -1;
+}
+
+int ConsoleRecorder::read(void)
+{
+    if (stream == NULL)
+        return -1;
+
+    int c = stream->read();
+    if (c >= 0)
+    {
+        uint8_t byte = c;
+        record(false, &byte, 1);
+    }
+    return c;
+}
+
+size_t ConsoleRecorder::readBytes(char *buffer, size_t length)
+{
+    if (stream == NULL)
+        return 0;
+
+    size_t count = stream->readBytes(buffer, length);
+    record(false, (const uint8_t *)buffer, count);
+    return count;
+}
+
+size_t ConsoleRecorder::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ConsoleRecorder::write(const uint8_t *buffer, size_t size)
+{
+    if (stream == NULL)
+        return 0;
+
+    size_t count = stream->write(buffer, size);
+    record(true, buffer, count);
+    return count;
+}
+
+int ConsoleRecorder::availableForWrite(void)
+{
+    return stream != NULL ? stream->availableForWrite() : 0;
+}
+
+void ConsoleRecorder::flush(void)
+{
+    flushTrace();
+    if (stream != NULL)
+        stream->flush();
+}
@@ -0,0 +1,57 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLERECORDER_H
+#define _CONSOLERECORDER_H
+
+#include <Arduino.h>
+
+#ifndef CONSOLE_TRACE_RECORD
+#define CONSOLE_TRACE_RECORD 32 // bytes collected in one trace record
+#endif
+
+// Stream wrapper that records a session: all bytes read from and written to the
+// wrapped stream, with the micros() they were read or written, go to a trace.
+//
+// Trace format: the magic "CIT1", then records of
+//   tag      bit 7 set for output, bits 0-6 the number of bytes - 1
+//   delta    micros() since the previous record, unsigned LEB128
+//   bytes    the data
+// Bytes in the same direction within 1 ms are merged into one record.
+class ConsoleRecorder : public Stream
+{
+
+private:
+  Stream *stream;
+  Print *trace;
+  uint32_t last_time;    // time of the previous record
+  uint32_t pending_time; // time of the record being collected
+  uint8_t pending[CONSOLE_TRACE_RECORD];
+  uint8_t pending_len;
+  bool pending_output;
+  bool started; // the magic was written
+
+  void record(bool output, const uint8_t *data, size_t len);
+  void emit(void);
+
+public:
+  static const uint32_t MERGE_TIME = 1000;
+
+  ConsoleRecorder(Stream *wrapped, Print *out);
+
+  void flushTrace(void);
+
+  virtual int available(void);
+  virtual int peek(void);
+  virtual int read(void);
+  virtual size_t readBytes(char *buffer, size_t length);
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual int availableForWrite(void);
+  virtual void flush(void);
+
+  using Print::write;
+  using Stream::readBytes;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleRing.h"
+
+// The size must be a power of two, other sizes are rounded down, see capacity()
+// Without a buffer or with size 0 the ring holds nothing and every push is an overflow
+ConsoleRing::ConsoleRing(uint8_t *buffer, size_t size, uint32_t *times)
+{
+    size_t bits = 1;
+    while (bits <= size / 2)
+        bits <<= 1;
+
+    data = size > 0 ? buffer : NULL;
+    stamps = times;
+    mask = data != NULL ? bits - 1 : 0;
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    notifier = NULL;
+}
+
+// ======== Producer =========================
+
+// Add bytes that arrived at time, returns the number of bytes that fit
+size_t ConsoleRing::push(const uint8_t *bytes, size_t count, uint32_t time)
+{
+    if (data == NULL)
+    {
+        __atomic_store_n(&dropped, dropped + count, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    size_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    size_t room = mask + 1 - (pos - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+    if (count > room)
+    {
+        __atomic_store_n(&dropped, dropped + count - room, __ATOMIC_RELAXED);
+        count = room;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        data[(pos + i) & mask] = bytes[i];
+        if (stamps != NULL)
+            stamps[(pos + i) & mask] = time;
+    }
+
+    // publish the bytes to the consumer
+    __atomic_store_n(&head, pos + count, __ATOMIC_RELEASE);
+    if (count > 0 && notifier != NULL)
+        notifier->notify();
+    return count;
+}
+
+bool ConsoleRing::push(uint8_t c, uint32_t time)
+{
+    return push(&c, 1, time) == 1;
+}
+
+// Wake the consumer after every push, set before the producer starts
+void ConsoleRing::setNotifier(ConsoleNotifier *waiter)
+{
+    notifier = waiter;
+}
+
+// Number of bytes the ring holds, the size rounded down to a power of two
+size_t ConsoleRing::capacity(void)
+{
+    return data != NULL ? mask + 1 : 0;
+}
+
+// Number of bytes dropped because the ring was full
+size_t ConsoleRing::overflows(void)
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+// ======== Consumer =========================
+
+// Arrival time of the next byte, 0 without a byte or without timestamps
+uint32_t ConsoleRing::arrival(void)
+{
+    if (stamps == NULL || available() == 0)
+        return 0;
+    return stamps[tail & mask];
+}
+
+int ConsoleRing::available(void)
+{
+    return (int)(__atomic_load_n(&head, __ATOMIC_ACQUIRE) - tail);
+}
+
+int ConsoleRing::peek(void)
+{
+    if (available() == 0)
+        return -1;
+    return data[tail & mask];
+}
+
+int ConsoleRing::read(void)
+{
+    if (available() == 0)
+        return -1;
+
+    uint8_t c = data[tail & mask];
+
+    // hand the slot back to the producer
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    return c;
+}
+
+size_t ConsoleRing::readBytes(char *buffer, size_t length)
+{
+    size_t count = available();
+    if (count > length)
+        count = length;
+
+    for (size_t i = 0; i < count; i++)
+        buffer[i] = data[(tail + i) & mask];
+
+    __atomic_store_n(&tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+// The ring is an input, output is not accepted
+size_t ConsoleRing::write(uint8_t)
+{
+    return 0;
+}
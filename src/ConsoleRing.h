@@ -0,0 +1,51 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLERING_H
+#define _CONSOLERING_H
+
+#include <Arduino.h>
+#include "ConsoleNotifier.h"
+
+// Single-producer single-consumer ring of input bytes with their arrival time
+// The producer (an ISR, or the UART event task on another core) calls push(),
+// the consumer reads it as a Stream, e.g. with ConsoleInput::setInput().
+// No locks are used: each index is written by one side only and published
+// with release/acquire ordering, which also holds between cores.
+// The indices are native words, so this is meant for 32-bit targets.
+class ConsoleRing : public Stream
+{
+
+private:
+  uint8_t *data;
+  uint32_t *stamps; // arrival time of each byte, optional
+  size_t mask;      // size - 1, the size is a power of two
+  size_t head;      // next write position, written by the producer only
+  size_t tail;      // next read position, written by the consumer only
+  size_t dropped;   // bytes that did not fit, written by the producer only
+  ConsoleNotifier *notifier;
+
+public:
+  ConsoleRing(uint8_t *buffer, size_t size, uint32_t *times = NULL);
+
+  // Producer side
+  size_t push(const uint8_t *bytes, size_t count, uint32_t time);
+  bool push(uint8_t c, uint32_t time);
+  size_t capacity(void);
+  size_t overflows(void);
+  void setNotifier(ConsoleNotifier *waiter);
+
+  // Consumer side
+  uint32_t arrival(void);
+
+  virtual int available(void);
+  virtual int peek(void);
+  virtual int read(void);
+  virtual size_t readBytes(char *buffer, size_t length);
+  virtual size_t write(uint8_t);
+
+  using Stream::readBytes;
+  using Print::write;
+};
+
+#endif
@@ -0,0 +1,199 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleServer.h"
+#include <new>
+
+// Arena layout, every part aligned for the objects it holds:
+//   shared history: ConsoleHistory, history buffer, index words
+//   per session:    in use flag, ConsoleInput, line buffer, history buffer, index words
+
+#define SLOT_ALIGN alignof(ConsoleInput)
+
+static inline size_t align_up(size_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+static inline size_t history_bytes(size_t history_size, uint16_t history_entries)
+{
+    if (history_size == 0)
+        return 0;
+    return align_up(history_size, sizeof(uint16_t)) +
+           ConsoleHistory::indexWords(history_entries, true) * sizeof(uint16_t);
+}
+
+static inline size_t flag_bytes()
+{
+    return align_up(sizeof(bool), SLOT_ALIGN);
+}
+
+size_t ConsoleServer::sessionSize(size_t line_size, size_t history_size, uint16_t history_entries, bool share_history)
+{
+    size_t size = flag_bytes() + align_up(sizeof(ConsoleInput), sizeof(uint16_t)) + align_up(line_size, sizeof(uint16_t));
+    if (!share_history)
+        size += history_bytes(history_size, history_entries);
+    return align_up(size, SLOT_ALIGN);
+}
+
+size_t ConsoleServer::sharedSize(size_t history_size, uint16_t history_entries)
+{
+    if (history_size == 0)
+        return 0;
+    return align_up(align_up(sizeof(ConsoleHistory), sizeof(uint16_t)) + history_bytes(history_size, history_entries),
+                    SLOT_ALIGN);
+}
+
+// Create a server for as many sessions as fit in the arena, see sessionSize()
+// Each session has a line of line_size bytes and a history of history_size bytes with up to
+// history_entries lines, or with share_history set one history of that size for all sessions
+ConsoleServer::ConsoleServer(uint8_t *arena, size_t size, size_t line_size, size_t history_size,
+                             uint16_t history_entries, bool share_history)
+{
+    this->line_size = line_size;
+    this->history_entries = history_entries;
+    this->history_size = share_history || !CONSOLE_HISTORY ? 0 : history_size;
+    shared = NULL;
+    polled = NULL;
+    slots = NULL;
+    slot_count = 0;
+    slot_size = sessionSize(line_size, this->history_size, history_entries, false);
+
+    if (arena == NULL)
+        return;
+
+    // the arena is a byte array, start at a position aligned for the objects
+    size_t skip = align_up((uintptr_t)arena, SLOT_ALIGN) - (uintptr_t)arena;
+    if (skip > size)
+        return;
+    arena += skip;
+    size -= skip;
+
+    size_t history = CONSOLE_HISTORY && share_history ? sharedSize(history_size, history_entries) : 0;
+    if (history > size)
+        return;
+    if (history > 0)
+    {
+        char *buffer = (char *)arena + align_up(sizeof(ConsoleHistory), sizeof(uint16_t));
+        uint16_t *words = (uint16_t *)(buffer + align_up(history_size, sizeof(uint16_t)));
+        shared = new (arena) ConsoleHistory(buffer, history_size, words, history_entries, true);
+    }
+
+    slots = arena + history;
+    slot_count = (size - history) / slot_size;
+    for (size_t i = 0; i < slot_count; i++)
+        *(bool *)(slots + i * slot_size) = false;
+}
+
+ConsoleServer::~ConsoleServer()
+{
+    for (size_t i = 0; i < slot_count; i++)
+        close(slot(i));
+    if (shared != NULL)
+        shared->~ConsoleHistory();
+}
+
+// Session in a slot, or NULL if the slot is free
+ConsoleInput *ConsoleServer::slot(size_t index)
+{
+    uint8_t *base = slots + index * slot_size;
+    if (!*(bool *)base)
+        return NULL;
+    return (ConsoleInput *)(base + flag_bytes());
+}
+
+// Start a session on a stream, returns NULL when the arena is full
+// The session can be configured like any ConsoleInput, its prompt is drawn by the next poll()
+ConsoleInput *ConsoleServer::open(Stream *stream)
+{
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        uint8_t *base = slots + i * slot_size;
+        if (*(bool *)base)
+            continue;
+
+        uint8_t *object = base + flag_bytes();
+        char *line = (char *)object + align_up(sizeof(ConsoleInput), sizeof(uint16_t));
+        char *history = line + align_up(line_size, sizeof(uint16_t));
+        uint16_t *words = (uint16_t *)(history + align_up(history_size, sizeof(uint16_t)));
+
+        ConsoleInput *session;
+        if (history_size > 0)
+            session = new (object) ConsoleInput(stream, line, line_size, history, history_size, words, history_entries);
+        else
+            session = new (object) ConsoleInput(stream, line, line_size);
+        if (shared != NULL)
+            session->setHistory(shared);
+
+        *(bool *)base = true;
+        return session;
+    }
+    return NULL;
+}
+
+// End a session, its slot can be used by the next open()
+void ConsoleServer::close(ConsoleInput *session)
+{
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        if (session == NULL || slot(i) != session)
+            continue;
+
+        session->~ConsoleInput();
+        *(bool *)(slots + i * slot_size) = false;
+        return;
+    }
+}
+
+// Poll every session with work to do, max_bytes limits the input decoded per session
+// Idle sessions cost one check, returns the number of special keys of all sessions
+size_t ConsoleServer::poll(size_t max_bytes)
+{
+    size_t keys = 0;
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        ConsoleInput *session = slot(i);
+        if (session != NULL && !session->idle())
+        {
+            polled = session;
+            keys += session->poll(max_bytes);
+        }
+    }
+    polled = NULL;
+    return keys;
+}
+
+// Number of sessions that fit in the arena
+size_t ConsoleServer::capacity()
+{
+    return slot_count;
+}
+
+// Number of open sessions
+size_t ConsoleServer::count()
+{
+    size_t n = 0;
+    for (size_t i = 0; i < slot_count; i++)
+        if (slot(i) != NULL)
+            n++;
+    return n;
+}
+
+// Session in slot index, or NULL when the slot is free
+ConsoleInput *ConsoleServer::get(size_t index)
+{
+    return index < slot_count ? slot(index) : NULL;
+}
+
+// Session being polled, for command handlers and line callbacks shared by all sessions
+// NULL outside poll()
+ConsoleInput *ConsoleServer::current()
+{
+    return polled;
+}
+
+// History shared by all sessions, or NULL
+ConsoleHistory *ConsoleServer::getHistory()
+{
+    return shared;
+}
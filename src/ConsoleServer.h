@@ -0,0 +1,49 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLESERVER_H
+#define _CONSOLESERVER_H
+
+#include <Arduino.h>
+#include "ConsoleInput.h"
+
+// Several console sessions polled from one loop, e.g. the UART and a few telnet clients
+// The sessions, their lines and histories are stored in one arena provided by the application,
+// nothing is allocated on the heap. With a shared history all sessions add to and recall from
+// one history at the start of the arena, each session then only stores its object and its line.
+class ConsoleServer
+{
+
+private:
+  uint8_t *slots;           // first session slot in the arena
+  size_t slot_size;         // bytes per session, see sessionSize()
+  size_t slot_count;        // number of sessions that fit in the arena
+  size_t line_size;
+  size_t history_size;      // history bytes per session, 0 with a shared history
+  uint16_t history_entries;
+  ConsoleHistory *shared;   // history of all sessions or NULL
+  ConsoleInput *polled;     // session being polled
+
+  ConsoleInput *slot(size_t index);
+
+public:
+  ConsoleServer(uint8_t *arena, size_t size, size_t line_size, size_t history_size = 0, uint16_t history_entries = 16,
+                bool share_history = false);
+  virtual ~ConsoleServer();
+
+  // Arena bytes per session and for a shared history
+  static size_t sessionSize(size_t line_size, size_t history_size, uint16_t history_entries, bool share_history);
+  static size_t sharedSize(size_t history_size, uint16_t history_entries);
+
+  ConsoleInput *open(Stream *stream);
+  void close(ConsoleInput *session);
+  size_t poll(size_t max_bytes = 0);
+
+  size_t capacity();
+  size_t count();
+  ConsoleInput *get(size_t index);
+  ConsoleInput *current();
+  ConsoleHistory *getHistory();
+};
+
+#endif
@@ -0,0 +1,322 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#include "ConsoleTelnet.h"
+#include "ConsoleInput.h"
+
+// Commands, RFC 854
+#define TELNET_SE 240
+#define TELNET_IP 244 // interrupt process, passed as Ctrl+C
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_IAC 255
+
+// Options
+#define OPT_ECHO 1
+#define OPT_SGA 3
+#define OPT_NAWS 31
+
+// Parser states
+#define TN_DATA 0
+#define TN_CR 1  // after a CR, a following NUL is dropped
+#define TN_IAC 2
+#define TN_OPTION 3
+#define TN_SB 4
+#define TN_SB_DATA 5
+#define TN_SB_IAC 6
+
+// Option states, an option we asked for is enabled by the answer without replying
+#define OPT_OFF 0
+#define OPT_WANT 1
+#define OPT_ON 2
+
+// Index into options of an option on the local (DO, DONT) or remote (WILL, WONT) side, -1 if refused
+static int8_t option_index(bool local, uint8_t option)
+{
+    if (local)
+        return option == OPT_ECHO ? 0 : option == OPT_SGA ? 1 : -1;
+    return option == OPT_SGA ? 2 : option == OPT_NAWS ? 3 : -1;
+}
+
+ConsoleTelnet::ConsoleTelnet(Stream *client)
+{
+    console = NULL;
+    this->client = NULL;
+    iac_owed = false;
+    head = 0;
+    count = 0;
+    state = TN_DATA;
+    columns = 0;
+    rows = 0;
+    memset(options, OPT_OFF, sizeof(options));
+    if (client != NULL)
+        begin(client);
+}
+
+// Start a session on a connected client and ask it for character mode
+void ConsoleTelnet::begin(Stream *client)
+{
+    static const uint8_t hello[] PROGMEM = {TELNET_IAC, TELNET_WILL, OPT_ECHO, TELNET_IAC, TELNET_WILL, OPT_SGA,
+                                            TELNET_IAC, TELNET_DO,   OPT_SGA,  TELNET_IAC, TELNET_DO,   OPT_NAWS};
+
+    this->client = client;
+    iac_owed = false;
+    head = 0;
+    count = 0;
+    state = TN_DATA;
+    columns = 0;
+    rows = 0;
+    memset(options, OPT_WANT, sizeof(options));
+    if (client == NULL)
+        return;
+
+    uint8_t buf[sizeof(hello)];
+    memcpy_P(buf, hello, sizeof(hello));
+    client->write(buf, sizeof(buf));
+}
+
+// Console that receives the window size reported by the client
+void ConsoleTelnet::setConsole(ConsoleInput *console)
+{
+    this->console = console;
+    if (console != NULL && columns > 0)
+        console->setWindowSize(columns, rows);
+}
+
+// Window size reported by the client, 0 until it is known
+uint16_t ConsoleTelnet::getColumns()
+{
+    return columns;
+}
+
+uint16_t ConsoleTelnet::getRows()
+{
+    return rows;
+}
+
+// ======== Input =========================
+
+// Parse the received bytes while there is room for their data
+void ConsoleTelnet::receive()
+{
+    if (client == NULL)
+        return;
+
+    while (count < sizeof(data) && client->available() > 0)
+    {
+        int c = client->read();
+        if (c < 0)
+            break;
+        parse(c);
+    }
+}
+
+inline void ConsoleTelnet::push(uint8_t c)
+{
+    data[(head + count) % sizeof(data)] = c;
+    count++;
+}
+
+void ConsoleTelnet::parse(uint8_t c)
+{
+    switch (state)
+    {
+    case TN_CR:
+        state = TN_DATA;
+        if (c == 0)
+            return;
+        // fall through
+
+    case TN_DATA:
+        if (c == TELNET_IAC)
+        {
+            state = TN_IAC;
+            return;
+        }
+        if (c == '\r')
+            state = TN_CR;
+        push(c);
+        return;
+
+    case TN_IAC:
+        state = TN_DATA;
+        if (c == TELNET_IAC)
+            push(c);
+        else if (c == TELNET_IP)
+            push(0x03);
+        else if (c == TELNET_SB)
+            state = TN_SB;
+        else if (c >= TELNET_WILL)
+        {
+            command = c;
+            state = TN_OPTION;
+        }
+        return;
+
+    case TN_OPTION:
+        negotiate(command, c);
+        state = TN_DATA;
+        return;
+
+    case TN_SB:
+        sub_option = c;
+        sub_len = 0;
+        state = TN_SB_DATA;
+        return;
+
+    case TN_SB_DATA:
+        if (c == TELNET_IAC)
+            state = TN_SB_IAC;
+        else if (sub_len < sizeof(sub))
+            sub[sub_len++] = c;
+        return;
+
+    case TN_SB_IAC:
+        if (c == TELNET_IAC)
+        { // escaped 255 in the parameters
+            if (sub_len < sizeof(sub))
+                sub[sub_len++] = c;
+            state = TN_SB_DATA;
+            return;
+        }
+
+        state = TN_DATA;
+        if (c == TELNET_SE && sub_option == OPT_NAWS && sub_len == 4)
+        {
+            columns = sub[0] << 8 | sub[1];
+            rows = sub[2] << 8 | sub[3];
+            if (console != NULL)
+                console->setWindowSize(columns, rows);
+        }
+        return;
+    }
+}
+
+// Answer WILL, WONT, DO or DONT, RFC 1143 without the queue bits
+void ConsoleTelnet::negotiate(uint8_t verb, uint8_t option)
+{
+    bool local = verb == TELNET_DO || verb == TELNET_DONT;
+    bool enable = verb == TELNET_WILL || verb == TELNET_DO;
+    int8_t index = option_index(local, option);
+
+    if (index < 0)
+    { // refuse options that are not supported, disabling them needs no answer
+        if (enable)
+            send(local ? TELNET_WONT : TELNET_DONT, option);
+        return;
+    }
+
+    uint8_t before = options[index];
+    options[index] = enable ? OPT_ON : OPT_OFF;
+
+    // only a change of an option we did not ask for is answered
+    if (before == OPT_OFF && enable)
+        send(local ? TELNET_WILL : TELNET_DO, option);
+    else if (before == OPT_ON && !enable)
+        send(local ? TELNET_WONT : TELNET_DONT, option);
+}
+
+void ConsoleTelnet::send(uint8_t verb, uint8_t option)
+{
+    uint8_t buf[3] = {TELNET_IAC, verb, option};
+    settle();
+    client->write(buf, sizeof(buf));
+}
+
+int ConsoleTelnet::available(void)
+{
+    receive();
+    return count;
+}
+
+int ConsoleTelnet::peek(void)
+{
+    receive();
+    return count > 0 ? data[head] : -1;
+}
+
+int ConsoleTelnet::read(void)
+{
+    receive();
+    if (count == 0)
+        return -1;
+
+    uint8_t c = data[head];
+    head = (head + 1) % sizeof(data);
+    count--;
+    return c;
+}
+
+// ======== Output =========================
+
+size_t ConsoleTelnet::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+// Send the second byte of an escaped IAC the client did not accept, false while it is still owed
+bool ConsoleTelnet::settle()
+{
+    if (iac_owed)
+        iac_owed = client->write((uint8_t)TELNET_IAC) == 0;
+    return !iac_owed;
+}
+
+// Write in bulk, IAC bytes are doubled
+// Returns the number of bytes of buffer that were written, less than size when the client did
+// not accept all of them. An IAC counts as written once its first byte was, the second one is
+// owed and sent before anything else, a single IAC would start a command.
+size_t ConsoleTelnet::write(const uint8_t *buffer, size_t size)
+{
+    static const uint8_t escaped_iac[2] = {TELNET_IAC, TELNET_IAC};
+
+    if (client == NULL || !settle())
+        return 0;
+
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (buffer[i] != TELNET_IAC)
+            continue;
+
+        // the run before the IAC, then the IAC twice
+        size_t written = i > start ? client->write(buffer + start, i - start) : 0;
+        if (written < i - start)
+            return start + written;
+
+        written = client->write(escaped_iac, 2);
+        if (written == 0)
+            return i;
+        if (written == 1)
+        {
+            iac_owed = true;
+            return i + 1;
+        }
+        start = i + 1;
+    }
+    if (start < size)
+        start += client->write(buffer + start, size - start);
+    return start;
+}
+
+// Space of the client, less an owed IAC
+int ConsoleTelnet::availableForWrite(void)
+{
+    if (client == NULL)
+        return 0;
+
+    int space = client->availableForWrite() - (iac_owed ? 1 : 0);
+    return space > 0 ? space : 0;
+}
+
+void ConsoleTelnet::flush(void)
+{
+    if (client == NULL)
+        return;
+
+    settle();
+    client->flush();
+}
@@ -0,0 +1,65 @@
+/* MIT License - Copyright (c) 2020 Francis Van Roie francis@netwize.be
+   For full license information read the LICENSE file in the project folder */
+
+#ifndef _CONSOLETELNET_H
+#define _CONSOLETELNET_H
+
+#include <Arduino.h>
+
+#ifndef CONSOLE_TELNET_BUFFER
+#define CONSOLE_TELNET_BUFFER 64 // received bytes kept after the telnet commands are removed, at most 255
+#endif
+
+class ConsoleInput;
+
+// Telnet protocol on top of a network client, e.g. a WiFiClient, for use as console stream
+// Telnet commands are removed from the input and IAC bytes are escaped in the output.
+// begin() asks the client for character mode: the server echoes (ECHO), both sides suppress
+// go-ahead (SGA) and the client reports its window size (NAWS), which is passed to the console.
+// Other options are refused.
+class ConsoleTelnet : public Stream
+{
+
+private:
+  Stream *client;
+  ConsoleInput *console;
+  uint8_t data[CONSOLE_TELNET_BUFFER]; // ring of received data bytes
+  uint8_t head;                        // position of the next data byte
+  uint8_t count;                       // data bytes in the ring
+  uint8_t state;                       // position in the command parser
+  uint8_t command;                     // WILL, WONT, DO or DONT being parsed
+  uint8_t sub_option;                  // option of the subnegotiation being parsed
+  uint8_t sub[4];                      // subnegotiation parameters
+  uint8_t sub_len;
+  uint8_t options[4]; // state of local ECHO and SGA, remote SGA and NAWS
+  bool iac_owed;      // the second byte of an escaped IAC was not accepted yet
+  uint16_t columns;
+  uint16_t rows;
+
+  bool settle();
+  void receive();
+  void parse(uint8_t c);
+  void push(uint8_t c);
+  void negotiate(uint8_t verb, uint8_t option);
+  void send(uint8_t verb, uint8_t option);
+
+public:
+  ConsoleTelnet(Stream *client = NULL);
+
+  void begin(Stream *client);
+  void setConsole(ConsoleInput *console);
+  uint16_t getColumns();
+  uint16_t getRows();
+
+  virtual int available(void);
+  virtual int peek(void);
+  virtual int read(void);
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual int availableForWrite(void);
+  virtual void flush(void);
+
+  using Print::write;
+};
+
+#endif